@@ -0,0 +1,40 @@
+#!/bin/sh
+#End-to-end benchmark for covid.c over generated datasets
+#usage: ./bench.sh [results.csv] [rows...]   (default rows: 10000 1000000 50000000)
+#Each size is generated once under bench_data/, then covid is run cold (no column cache) and
+#one CSV line per size is appended to the results file, tagged with the current git revision
+set -e
+
+cd "$(dirname "$0")"
+results=${1:-bench_results.csv}
+[ $# -gt 0 ] && shift
+sizes=${*:-10000 1000000 50000000}
+shards=${SHARDS:-15}
+prompts=${PROMPTS:-10000}
+
+mkdir -p bench_data
+gcc -O2 -pthread -o bench_data/covid covid.c -lm -lz
+gcc -O2 -o bench_data/covid_gen covid_gen.c
+version=$(git describe --always --dirty 2>/dev/null || echo unknown)
+
+if [ ! -f "$results" ]; then
+    echo "version,rows,files,bytes,records,groups,prompts,ingest_s,parse_s,dedup_s,merge_s,index_s,query_s,output_s,total_s" > "$results"
+fi
+
+for rows in $sizes; do
+    #Split the row count into zips x weeks, with weeks capped at 5000 (about 96 years of data)
+    if [ "$rows" -le 10000 ]; then weeks=100; elif [ "$rows" -le 1000000 ]; then weeks=1000; else weeks=5000; fi
+    zips=$(( (rows + weeks - 1) / weeks ))
+    dir=bench_data/$rows
+    if [ ! -f "$dir/prompts.txt" ]; then
+        mkdir -p "$dir"
+        bench_data/covid_gen -z "$zips" -w "$weeks" -s "$shards" -o "$dir/covid_%d.csv" -q "$dir/prompts.txt" -Q "$prompts"
+    fi
+    start=$(date +%s.%N)
+    bench_data/covid -C -T "$dir/timings.json" -p "$dir/covid_%d.csv" -n "$shards" "$dir/prompts.txt" "$dir/output.txt"
+    end=$(date +%s.%N)
+    #Flatten the JSON object written by -T into the CSV columns above
+    sed -e 's/[{}" ]//g' -e 's/[a-z_]*://g' "$dir/timings.json" | \
+        awk -v v="$version" -v r="$rows" -v s="$start" -v e="$end" '{ printf "%s,%s,%s,%.6f\n", v, r, $0, e - s }' >> "$results"
+    tail -n 1 "$results"
+done
@@ -0,0 +1,29 @@
+#!/bin/sh
+#Regression checks for covid.c that compare the approximate mode against exact mode
+#usage: ./check.sh
+#Each check writes a tiny data file under check_data/, answers the same prompts with and without -X, and
+#fails if the sketch answers (with their error bounds cut off) differ from the exact ones
+set -e
+
+cd "$(dirname "$0")"
+mkdir -p check_data
+gcc -O2 -pthread -o check_data/covid covid.c -lm -lz
+header="ZIP Code,Week Number,Week Start,Week End,Cases - Weekly,Cases - Cumulative,Case Rate - Weekly,Case Rate - Cumulative,Tests - Weekly,Tests - Cumulative,Test Rate - Weekly,Test Rate - Cumulative,Percent Tested Positive - Weekly,Percent Tested Positive - Cumulative,Deaths - Weekly,Deaths - Cumulative,Death Rate - Weekly,Death Rate - Cumulative,Population,Row ID,ZIP Code Location"
+status=0
+
+#A row whose Week Start is 01/01/1970 is day 0, which the sketch week table once took for an empty slot
+printf '%s\n%s\n' "$header" \
+    "60601,1,01/01/1970,01/07/1970,5,5,,,10,10,,,,,1,1,,,100,60601-1970-1,POINT (-87.6 41.8)" > check_data/day0.csv
+printf '60601 1 1970\ndistinct zips 01/01/1970\n' > check_data/day0_prompts.txt
+check_data/covid -C check_data/day0_prompts.txt check_data/day0_exact.txt check_data/day0.csv
+check_data/covid -X 0.01 check_data/day0_prompts.txt check_data/day0_sketch.txt check_data/day0.csv
+sed 's/ (.*)$//' check_data/day0_sketch.txt > check_data/day0_sketch_values.txt
+if cmp -s check_data/day0_exact.txt check_data/day0_sketch_values.txt; then
+    echo "day 0 sketch: ok"
+else
+    echo "day 0 sketch: differs from exact mode"
+    diff check_data/day0_exact.txt check_data/day0_sketch_values.txt || true
+    status=1
+fi
+
+exit $status
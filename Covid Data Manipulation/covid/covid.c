@@ -3,245 +3,4714 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <zlib.h>
+#include "covid_dates.h"
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
 
 //Struct data that has 2 instances data_entry and output
+//The counts are long long because a (zip, month, year) group sums them over every row that falls into it
 typedef struct data {
   int zip;
   int month;
   int year;
+  long long cases;
+  long long tests;
+  long long deaths;
+} data;
+
+//Number of columns in a covid_N.csv row
+#define NO_OF_FIELDS 21
+
+//Rows parsed before they are handed to the store in one go
+#define INGEST_BATCH 1024
+
+//A field of a row as a slice of the mapped file, not NUL-terminated
+typedef struct field {
+  const char * ptr;
+  size_t len;
+} field;
+
+//Packed binary key used to detect duplicate rows (zip, week start day, cases, tests, deaths)
+typedef struct record_key {
+  int zip;
+  int day;
   int cases;
   int tests;
   int deaths;
-} data;
+} record_key;
 
-//Function to compute answers based on input file
-char * compute(int zip, int month, int year, int index, int count, data *data_entry, data *output){
-    for (int i=0; i<count; i++){
-        if (zip == data_entry[i].zip){
-            if(month == data_entry[i].month){
-                if(year == data_entry[i].year){
-                    output[index].cases = output[index].cases + data_entry[i].cases;
-                    output[index].tests = output[index].tests + data_entry[i].tests;
-                    output[index].deaths = output[index].deaths + data_entry[i].deaths;
-                }
-            }
-        }
+//Bump allocator: blocks are carved up front to back and all released at once by arena_free
+//data is aligned to 16 bytes (the header alone would leave it at offset 24), so every allocation is too
+typedef struct arena_block {
+  struct arena_block * next;
+  size_t size;
+  size_t used;
+  _Alignas(16) char data[];
+} arena_block;
+
+typedef struct arena {
+  arena_block * head;
+  size_t block_size;
+  size_t total;
+} arena;
+
+//Growable array whose elements live in fixed-size chunks taken from an arena
+//Elements never move, so growing costs no copying and no per-row malloc
+#define CHUNK_SHIFT 14
+#define CHUNK_ELEMS ((size_t)1 << CHUNK_SHIFT)
+typedef struct chunk_array {
+  char ** chunks;
+  size_t nchunks;
+  size_t chunks_size;
+  size_t count;
+  size_t elem_size;
+  arena * pool;
+} chunk_array;
+
+//Bytes one record takes in the store: a 16 bit zip id and week start day, 32 bit cases, tests and deaths
+#define RECORD_BYTES 16
+
+//Most distinct zips a store can number with its 16 bit zip ids
+#define MAX_ZIP_IDS 65536
+
+//Open-addressing hash set of records, linear probing, grown at 3/4 load
+//Records are kept densely in insertion order and slots hold index + 1 (0 marks an empty slot)
+//Each chunk of records is stored column by column (see record_columns), so a scan of one column reads no other
+//Zips are numbered densely as they first appear: zips[id] is the zip, zip_slots maps a zip to id + 1
+typedef struct record_set {
+  chunk_array records;
+  uint32_t * slots;
+  size_t capacity;
+  int * zips;
+  int nzips;
+  uint32_t * zip_slots;
+  size_t zip_capacity;
+} record_set;
+
+//Columns of one chunk of CHUNK_ELEMS records, laid out one after the other inside the chunk
+typedef struct record_columns {
+  uint16_t * zip_ids;
+  uint16_t * days;
+  int32_t * cases;
+  int32_t * tests;
+  int32_t * deaths;
+} record_columns;
+
+//Open-addressing hash table of summed cases/tests/deaths keyed by (zip, month, year)
+typedef struct group_table {
+  data * slots;
+  unsigned char * used;
+  size_t capacity;
+  size_t count;
+} group_table;
+
+//Coordinates of one zip, from the POINT (lon lat) of its ZIP Code Location column
+typedef struct place {
+  int zip;
+  float lon;
+  float lat;
+} place;
+
+//Open-addressing hash table of zip -> place, zip -1 marks an empty slot
+//The first location seen for a zip is kept
+typedef struct place_table {
+  place * slots;
+  size_t capacity;
+  size_t count;
+} place_table;
+
+//Row counters and worker-side phase times of an ingest, summed over the shards by merge_shards
+//The counters are always kept, the seconds only while collect_timings is set
+//spilled counts the unique records kept out of the store: those of an out-of-core run, dropped once their
+//partition is done, or the rows an approximate run only added to its sketches
+typedef struct ingest_stats {
+  size_t rows_read;
+  size_t rows_rejected;
+  size_t duplicates;
+  size_t spilled;
+  double io_seconds;
+  double parse_seconds;
+  double dedup_seconds;
+} ingest_stats;
+
+//Unique records of one shard (or of the merged dataset) and their (zip, month, year) aggregates
+//The key of a record carries all of its data, see data_entry_struct
+//Key storage comes from the store's own arena, so a worker thread never shares an allocator
+typedef struct store {
+  arena pool;
+  record_set keys;
+  group_table groups;
+  place_table places;
+  size_t bytes;
+  ingest_stats stats;
+} store;
+
+//Wall and process CPU seconds spent in one phase
+typedef struct phase_time {
+  double wall;
+  double cpu;
+} phase_time;
+
+//Time spent in each phase of a run, written out with -T and reported by --stats
+//io, parse and dedup are summed over the worker threads (see ingest_stats), these are measured on the main thread
+typedef struct run_timings {
+  phase_time ingest;
+  phase_time merge;
+  phase_time index;
+  phase_time query;
+  phase_time output;
+} run_timings;
+
+//Set from the command line before ingestion starts; when clear the ingest loops skip every clock read
+static int collect_timings = 0;
+
+//Time of the cross-shard merges of this run, only accumulated while collect_timings is set
+static phase_time merge_phase;
+
+//Columns of one data file in file order, as kept in its binary cache sidecar
+//Day is the week start as a get_day number, the rates are the weekly rate columns,
+//lon and lat the ZIP Code Location point (NAN when the row has none)
+typedef struct column_set {
+  size_t rows;
+  size_t size;
+  int32_t * zip;
+  int32_t * day;
+  int32_t * cases;
+  int32_t * tests;
+  int32_t * deaths;
+  float * case_rate;
+  float * test_rate;
+  float * positive;
+  float * death_rate;
+  float * lon;
+  float * lat;
+} column_set;
+
+//Prefix sums of one weekly series up to and including day
+typedef struct series_point {
+  int day;
+  long long cases;
+  long long tests;
+  long long deaths;
+} series_point;
+
+//Per-zip weekly series sorted by week start, with prefix sums for O(log n) date-range totals
+//Zip z's points are points[offsets[z]] .. points[offsets[z + 1] - 1], zips[] is sorted;
+//all[] is the same series summed over every zip
+//The (zip, month, year) groups are also copied out by month for ranking prompts: month m (year * 12 + month - 1,
+//months[] sorted) owns month_groups[month_offsets[m]] .. month_groups[month_offsets[m + 1] - 1]
+//Zip locations sit in a grid x grid uniform grid over their bounding box for spatial prompts:
+//cell (cx, cy) owns places[cells[cy * grid + cx]] .. places[cells[cy * grid + cx + 1] - 1]
+typedef struct series_index {
+  int nzips;
+  int * zips;
+  size_t * offsets;
+  series_point * points;
+  series_point * all;
+  size_t nall;
+  int nmonths;
+  int * months;
+  size_t * month_offsets;
+  data * month_groups;
+  int nplaces;
+  place * places;
+  int grid;
+  double min_lon;
+  double min_lat;
+  double cell_lon;
+  double cell_lat;
+  size_t * cells;
+} series_index;
+
+//One zip of a ranking answer and its metric value for the month
+typedef struct rank_entry {
+  int zip;
+  double value;
+} rank_entry;
+
+//Metrics a ranking prompt can order the zips of a month by
+#define METRIC_CASES 0
+#define METRIC_TESTS 1
+#define METRIC_DEATHS 2
+#define METRIC_POSITIVITY 3
+#define NO_OF_METRICS 4
+static const char * metric_names[NO_OF_METRICS] = {"cases", "tests", "deaths", "positivity"};
+
+//One prompt from the input file or the server
+//QUERY_MONTH sums a (zip, month, year) group, QUERY_RANGE sums week starts in [start, end]
+//for one zip, or for every zip when zip is ALL_ZIPS
+//QUERY_TOP and QUERY_BOTTOM rank the zips of a month by metric and keep the first k in ranked
+//QUERY_BOX and QUERY_RADIUS sum the months from start to end over the zips located inside the box
+//(lon1, lat1)-(lon2, lat2), or within radius km of (lon1, lat1); matched counts those zips
+//QUERY_HEAVY ranks the k zips with the largest metric total over all the data into ranked,
+//QUERY_DISTINCT counts in matched the zips with a row for the week starting on start (every zip for ALL_ZIPS)
+//An approximate answer from -X sets approximate and its error bound: per metric for a month total, how far
+//it may be over in bound and under in under (non-zero only once the stream had negative values),
+//in bound[0] for a heavy hitter count or a distinct count
+#define QUERY_MONTH 0
+#define QUERY_RANGE 1
+#define QUERY_TOP 2
+#define QUERY_BOTTOM 3
+#define QUERY_BOX 4
+#define QUERY_RADIUS 5
+#define QUERY_HEAVY 6
+#define QUERY_DISTINCT 7
+#define ALL_ZIPS -1
+typedef struct query {
+  int kind;
+  int zip;
+  int month;
+  int year;
+  int start;
+  int end;
+  long long cases;
+  long long tests;
+  long long deaths;
+  int k;
+  int metric;
+  int nranked;
+  rank_entry * ranked;
+  double lon1;
+  double lat1;
+  double lon2;
+  double lat2;
+  double radius;
+  int matched;
+  int approximate;
+  long long bound[3];
+  long long under[3];
+} query;
+
+//Header of an incremental ingest checkpoint, followed by nfiles checkpoint_file entries (each followed
+//by its path), the nkeys record keys, the record set slots, the (zip, month, year) group table
+//and the nplaces zip locations
+#define CHECKPOINT_MAGIC "COVIDCKP"
+#define CHECKPOINT_VERSION 4
+typedef struct checkpoint_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t nfiles;
+  uint64_t nkeys;
+  uint64_t set_capacity;
+  uint64_t group_capacity;
+  uint64_t group_count;
+  uint64_t nplaces;
+} checkpoint_header;
+
+//How far one data file has been ingested: bytes [0, offset) end on a complete line, and the last
+//CHECKPOINT_WINDOW of them (or all, if fewer) hash to window_hash
+#define CHECKPOINT_WINDOW 65536
+typedef struct checkpoint_file {
+  uint64_t offset;
+  uint64_t window_hash;
+  uint32_t path_len;
+} checkpoint_file;
+
+//Header at the start of a cache sidecar, followed by the columns of column_set back to back
+//The cache is valid while the source file keeps the recorded size and mtime and its bytes still hash to
+//source_hash, so a same-size rewrite or a copy that keeps timestamps is caught too;
+//the checksum covers the column bytes so a torn or corrupt sidecar is rejected
+#define CACHE_MAGIC "COVIDCOL"
+#define CACHE_VERSION 3
+#define CACHE_COLUMNS 11
+typedef struct cache_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t columns;
+  uint64_t rows;
+  uint64_t source_size;
+  int64_t source_mtime_sec;
+  int64_t source_mtime_nsec;
+  uint64_t source_hash;
+  uint64_t checksum;
+} cache_header;
+
+//Function to return monotonic time in seconds
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Function to return the CPU time of the whole process (every thread) in seconds
+double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Function to open a timed phase, the matching phase_end adds the elapsed time to p
+static inline void phase_begin(phase_time * p) {
+    if (collect_timings) {
+        p->wall -= now_seconds();
+        p->cpu -= cpu_seconds();
     }
-    return 0;
+}
+
+//Function to close a timed phase opened with phase_begin
+static inline void phase_end(phase_time * p) {
+    if (collect_timings) {
+        p->wall += now_seconds();
+        p->cpu += cpu_seconds();
+    }
+}
+
+//Function to read n decimal digits starting at input
+int get_digits(const char input[], int n) {
+    int val = 0;
+    for (int i = 0; i < n; i++) {
+        val = val * 10 + (input[i] - '0');
+    }
+    return val;
 }
 
 //Function to get month from datestring
-int get_month(char input[], int index) {
-    char sub[2];
-    sub[0] = input[index];
-    sub[1] = input[index+1];
-    int month = atoi(sub);
-    return month;
+int get_month(const char input[], int index) {
+    return get_digits(input + index, 2);
 }
 
 //Function to get year from datestring
-int get_year(char input[], int index) {
-    char sub[4];
-    sub[0] = input[index];
-    sub[1] = input[index+1];
-    sub[2] = input[index+2];
-    sub[3] = input[index+3];
-    int year = atoi(sub);
-    return year;
+int get_year(const char input[], int index) {
+    return get_digits(input + index, 4);
 }
 
-//Function to write to outfile
-void write_file(data* output, char* path, int size) {
-    FILE * fout;
-    fout = fopen(path, "w");
-    if (fout != NULL) {
-        for (int i = 0; i < size; i++) {
-            fprintf(fout, "%d %d %d = %d,%d,%d\n", output[i].zip, output[i].month, output[i].year, output[i].cases, output[i].tests, output[i].deaths);
+//Function to count days since 01/01/1970 for a calendar date
+int civil_day(int year, int month, int day) {
+    //Shift the year to start in March so the leap day falls at the end
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yoe = year - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+//Function to convert a MM/DD/YYYY datestring into a day number (days since 1970-01-01)
+int get_day(const char input[]) {
+    return civil_day(get_year(input, 6), get_month(input, 0), get_digits(input + 3, 2));
+}
+
+//Function to hash a packed record key
+uint64_t hash_key(const record_key * key) {
+    uint64_t h = (uint64_t)(uint32_t)key->zip << 32 | (uint32_t)key->day;
+    h ^= ((uint64_t)(uint32_t)key->cases << 32 | (uint32_t)key->tests) * 0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t)(uint32_t)key->deaths * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+//Function to hash a (zip, month, year) group key
+uint64_t hash_group(int zip, int month, int year) {
+    uint64_t h = (uint64_t)(uint32_t)zip << 32 | (uint32_t)(year * 16 + month);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+//Function to start an empty arena that hands out memory in block_size blocks
+void arena_init(arena * a, size_t block_size) {
+    a->head = NULL;
+    a->block_size = block_size;
+    a->total = 0;
+}
+
+//Function to allocate size bytes (16-byte aligned) from the arena, exits when memory runs out
+void * arena_alloc(arena * a, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    if (a->head == NULL || a->head->size - a->head->used < size) {
+        size_t block = size > a->block_size ? size : a->block_size;
+        arena_block * fresh = malloc(sizeof(arena_block) + block);
+        if (fresh == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
         }
-        fclose(fout); 
-    } 
-    else {
-        perror("fopen"); 
+        fresh->next = a->head;
+        fresh->size = block;
+        fresh->used = 0;
+        a->head = fresh;
+        a->total += block;
+    }
+    void * ptr = a->head->data + a->head->used;
+    a->head->used += size;
+    return ptr;
+}
+
+//Function to release every block of the arena in one go
+void arena_free(arena * a) {
+    while (a->head != NULL) {
+        arena_block * next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+    a->total = 0;
+}
+
+//Function to start an empty chunked array of elem_size elements drawn from pool
+void chunks_init(chunk_array * arr, size_t elem_size, arena * pool) {
+    arr->chunks = NULL;
+    arr->nchunks = 0;
+    arr->chunks_size = 0;
+    arr->count = 0;
+    arr->elem_size = elem_size;
+    arr->pool = pool;
+}
+
+//Function to release the chunk directory, the chunks go with their arena
+void chunks_free(chunk_array * arr) {
+    free(arr->chunks);
+}
+
+//Function to get element i
+static inline void * chunk_at(const chunk_array * arr, size_t i) {
+    return arr->chunks[i >> CHUNK_SHIFT] + (i & (CHUNK_ELEMS - 1)) * arr->elem_size;
+}
+
+//Function to append an uninitialised element and return it
+void * chunk_push(chunk_array * arr) {
+    if (arr->count == arr->nchunks * CHUNK_ELEMS) {
+        if (arr->nchunks == arr->chunks_size) {
+            arr->chunks_size = arr->chunks_size != 0 ? arr->chunks_size * 2 : 16;
+            arr->chunks = realloc(arr->chunks, arr->chunks_size * sizeof(char *));
+            if (arr->chunks == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        arr->chunks[arr->nchunks++] = arena_alloc(arr->pool, CHUNK_ELEMS * arr->elem_size);
+    }
+    return chunk_at(arr, arr->count++);
+}
+
+//Function to allocate an empty record set with records drawn from pool, capacity must be a power of two
+void set_init(record_set * set, size_t capacity, arena * pool) {
+    chunks_init(&set->records, RECORD_BYTES, pool);
+    set->slots = calloc(capacity, sizeof(uint32_t));
+    set->capacity = capacity;
+    set->nzips = 0;
+    set->zip_capacity = 64;
+    set->zips = malloc(MAX_ZIP_IDS * sizeof(int));
+    set->zip_slots = calloc(set->zip_capacity, sizeof(uint32_t));
+    if (set->slots == NULL || set->zips == NULL || set->zip_slots == NULL) {
+        perror("malloc");
         exit(EXIT_FAILURE);
     }
 }
 
-        
-//Function to search and compare records to find unique
-int search(char * key, char * uniqueRecords[], int count) {
-    for (int i = 0; i < count; i++) {
-        if (strcmp(uniqueRecords[i], key) == 0) {   
-            return -1;
+void set_free(record_set * set) {
+    chunks_free(&set->records);
+    free(set->slots);
+    free(set->zips);
+    free(set->zip_slots);
+}
+
+//Function to get the columns of chunk c
+static inline record_columns set_columns(const record_set * set, size_t c) {
+    char * chunk = set->records.chunks[c];
+    record_columns cols = {
+        (uint16_t *)chunk,
+        (uint16_t *)(chunk + 2 * CHUNK_ELEMS),
+        (int32_t *)(chunk + 4 * CHUNK_ELEMS),
+        (int32_t *)(chunk + 8 * CHUNK_ELEMS),
+        (int32_t *)(chunk + 12 * CHUNK_ELEMS)
+    };
+    return cols;
+}
+
+//Function to unpack record i into a key
+static inline void set_get(const record_set * set, size_t i, record_key * key) {
+    record_columns cols = set_columns(set, i >> CHUNK_SHIFT);
+    size_t o = i & (CHUNK_ELEMS - 1);
+    key->zip = set->zips[cols.zip_ids[o]];
+    key->day = cols.days[o];
+    key->cases = cols.cases[o];
+    key->tests = cols.tests[o];
+    key->deaths = cols.deaths[o];
+}
+
+//Function to find the zip table slot of zip, or the empty slot where it belongs
+static inline size_t zip_probe(const record_set * set, int zip) {
+    size_t mask = set->zip_capacity - 1;
+    size_t i = hash_group(zip, 0, 0) & mask;
+    while (set->zip_slots[i] != 0 && set->zips[set->zip_slots[i] - 1] != zip) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+//Function to get the id of zip, or -1 if the set has no record of it
+static inline int zip_find(const record_set * set, int zip) {
+    return (int)set->zip_slots[zip_probe(set, zip)] - 1;
+}
+
+//Function to get the id of zip, numbering it if it is new; exits once the 16 bit ids run out
+int zip_intern(record_set * set, int zip) {
+    size_t i = zip_probe(set, zip);
+    if (set->zip_slots[i] != 0) {
+        return set->zip_slots[i] - 1;
+    }
+    if (set->nzips == MAX_ZIP_IDS) {
+        fprintf(stderr, "more than %d distinct zips\n", MAX_ZIP_IDS);
+        exit(EXIT_FAILURE);
+    }
+    set->zips[set->nzips++] = zip;
+    set->zip_slots[i] = set->nzips;
+    if (set->nzips * 4 > (int)set->zip_capacity * 3) {
+        uint32_t * old = set->zip_slots;
+        size_t old_capacity = set->zip_capacity;
+        set->zip_capacity *= 2;
+        set->zip_slots = calloc(set->zip_capacity, sizeof(uint32_t));
+        if (set->zip_slots == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t j = 0; j < old_capacity; j++) {
+            if (old[j] != 0) {
+                set->zip_slots[zip_probe(set, set->zips[old[j] - 1])] = old[j];
+            }
+        }
+        free(old);
+    }
+    return set->nzips - 1;
+}
+
+//Function to check whether record i holds key, whose zip has id zip_id
+static inline int set_match(const record_set * set, size_t i, const record_key * key, int zip_id) {
+    record_columns cols = set_columns(set, i >> CHUNK_SHIFT);
+    size_t o = i & (CHUNK_ELEMS - 1);
+    return cols.zip_ids[o] == zip_id && cols.days[o] == key->day && cols.cases[o] == key->cases
+           && cols.tests[o] == key->tests && cols.deaths[o] == key->deaths;
+}
+
+//Function to find the slot holding key, or the empty slot where it belongs; zip_id is -1 for an unseen zip
+size_t set_probe(record_set * set, const record_key * key, int zip_id) {
+    size_t mask = set->capacity - 1;
+    size_t i = hash_key(key) & mask;
+    while (set->slots[i] != 0 && (zip_id < 0 || !set_match(set, set->slots[i] - 1, key, zip_id))) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+//Function to double the slot array and reinsert every record index
+void set_grow(record_set * set) {
+    uint32_t * old = set->slots;
+    size_t old_capacity = set->capacity;
+    set->capacity *= 2;
+    set->slots = calloc(set->capacity, sizeof(uint32_t));
+    if (set->slots == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    size_t mask = set->capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i] != 0) {
+            //Every record is distinct, so the first empty slot is the right one
+            record_key key;
+            set_get(set, old[i] - 1, &key);
+            size_t j = hash_key(&key) & mask;
+            while (set->slots[j] != 0) {
+                j = (j + 1) & mask;
+            }
+            set->slots[j] = old[i];
         }
     }
+    free(old);
+}
+
+//Function to append a record without checking for duplicates, returns its index
+size_t set_append(record_set * set, const record_key * key) {
+    //The slot chunk_push returns is laid out by row; the record goes into the chunk's columns instead
+    chunk_push(&set->records);
+    size_t i = set->records.count - 1;
+    record_columns cols = set_columns(set, i >> CHUNK_SHIFT);
+    size_t o = i & (CHUNK_ELEMS - 1);
+    cols.zip_ids[o] = zip_intern(set, key->zip);
+    cols.days[o] = key->day;
+    cols.cases[o] = key->cases;
+    cols.tests[o] = key->tests;
+    cols.deaths[o] = key->deaths;
+    return i;
+}
+
+//Function to insert a key, returns 1 if the key is new and -1 if it was already seen
+int set_insert(record_set * set, const record_key * key) {
+    if ((set->records.count + 1) * 4 > set->capacity * 3) {
+        set_grow(set);
+    }
+    size_t i = set_probe(set, key, zip_find(set, key->zip));
+    if (set->slots[i] != 0) {
+        return -1;
+    }
+    set->slots[i] = set_append(set, key) + 1;
     return 1;
 }
 
-//Function for data entry into struct data * data_entry
-int data_entry_struct(char * record[], data * data_entry, int count){
-    int month = get_month(record[2],0);
-    int year = get_year(record[2],6);
-    int zip = atoi(record[0]);
-    int cases = atoi(record[4]);
-    int tests = atoi(record[8]);
-    int deaths = atoi(record[14]);
-    (data_entry+ count)->zip = zip;
-    (data_entry+ count)->month = month;
-    (data_entry+ count)->year = year;
-    (data_entry+ count)->cases = cases;
-    (data_entry+ count)->tests = tests;
-    (data_entry+ count)->deaths = deaths;
-    return 0;
+//Function to allocate an empty group table, capacity must be a power of two
+void group_init(group_table * groups, size_t capacity) {
+    groups->slots = malloc(capacity * sizeof(data));
+    groups->used = calloc(capacity, sizeof(unsigned char));
+    if (groups->slots == NULL || groups->used == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    groups->capacity = capacity;
+    groups->count = 0;
 }
 
-//Function to count records and save unique records 
-int countRecord(char * recordLine, char * uniqueRecords[], int *newCount, data *data_entry, data *output) {
-    char * record[21];
-    int count = 0;
-    char * key;
-    char * token = strtok(recordLine, ",");
-    while (token != NULL) {
-        record[count++] = token;
-        token = strtok(NULL, ",");
-    }
-    if(count == 21){
-        key = malloc(sizeof(char)*strlen(record[0]) + sizeof(char)*strlen(record[2])+ sizeof(char)*strlen(record[4])+ 
-        sizeof(char)*strlen(record[8])+ sizeof(char)*strlen(record[14])+1);
-        sprintf(key,"%s%s%s%s%s",record[0],record[2],record[4],record[8],record[14]);
-        if(search(key, uniqueRecords, *newCount) == 1){
-            uniqueRecords[*newCount] = malloc(sizeof(char)*strlen(key));
-            uniqueRecords[*newCount] = key;
-            data_entry_struct(record, data_entry, *newCount);
-            *newCount += 1;
+void group_free(group_table * groups) {
+    free(groups->slots);
+    free(groups->used);
+}
+
+//Function to find the slot holding a group, or the empty slot where it belongs
+size_t group_probe(group_table * groups, int zip, int month, int year) {
+    size_t mask = groups->capacity - 1;
+    size_t i = hash_group(zip, month, year) & mask;
+    while (groups->used[i]) {
+        data * slot = &groups->slots[i];
+        if (slot->zip == zip && slot->month == month && slot->year == year) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+//Function to double the table capacity and rehash every group
+void group_grow(group_table * groups) {
+    group_table bigger;
+    group_init(&bigger, groups->capacity * 2);
+    for (size_t i = 0; i < groups->capacity; i++) {
+        if (groups->used[i]) {
+            data * slot = &groups->slots[i];
+            size_t j = group_probe(&bigger, slot->zip, slot->month, slot->year);
+            bigger.slots[j] = *slot;
+            bigger.used[j] = 1;
+        }
+    }
+    bigger.count = groups->count;
+    group_free(groups);
+    *groups = bigger;
+}
+
+//Function to add one record's counts into its (zip, month, year) group
+void group_add(group_table * groups, data * record) {
+    if ((groups->count + 1) * 4 > groups->capacity * 3) {
+        group_grow(groups);
+    }
+    size_t i = group_probe(groups, record->zip, record->month, record->year);
+    if (!groups->used[i]) {
+        groups->slots[i] = *record;
+        groups->used[i] = 1;
+        groups->count++;
+        return;
+    }
+    groups->slots[i].cases += record->cases;
+    groups->slots[i].tests += record->tests;
+    groups->slots[i].deaths += record->deaths;
+}
+
+//Function to add every group of src into dst
+void group_merge(group_table * dst, group_table * src) {
+    for (size_t i = 0; i < src->capacity; i++) {
+        if (src->used[i]) {
+            group_add(dst, &src->slots[i]);
         }
+    }
+}
+
+//Function to look up a group, returns NULL if no record fell into it
+data * group_find(group_table * groups, int zip, int month, int year) {
+    size_t i = group_probe(groups, zip, month, year);
+    return groups->used[i] ? &groups->slots[i] : NULL;
+}
+
+//Function to compute answers based on input file
+char * compute(int zip, int month, int year, int index, group_table *groups, data *output){
+    data * group = group_find(groups, zip, month, year);
+    output[index].cases = group != NULL ? group->cases : 0;
+    output[index].tests = group != NULL ? group->tests : 0;
+    output[index].deaths = group != NULL ? group->deaths : 0;
     return 0;
+}
+
+//Function to allocate an empty place table with a power of two capacity
+void place_init(place_table * places, size_t capacity) {
+    places->slots = malloc(capacity * sizeof(place));
+    if (places->slots == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        places->slots[i].zip = -1;
     }
+    places->capacity = capacity;
+    places->count = 0;
 }
 
-int main(int argc, char* argv[]){
-    //Defining constants for file I/O
-    const char * filename = "../data/covid_";
-    const char * fileext = ".csv";
-    const int no_of_files = 15;
-
-    //Allocating memory for infile and outfile destination strings
-    char* infile = malloc(strlen(argv[1])*sizeof(char));
-    char* outfile = malloc(strlen(argv[2])*sizeof(char));
-    strcpy(infile, argv[1]);
-    strcpy(outfile, argv[2]);
-    
-    // Number of sets of input given in the input file
-    int data_entry_prompts = 0;
+void place_free(place_table * places) {
+    free(places->slots);
+}
 
-    //Memory allocation for output struct
-    data* output = malloc(sizeof(data) * 100);
+//Function to find the slot of zip, or the empty slot where it would go
+static inline size_t place_probe(const place_table * places, int zip) {
+    size_t mask = places->capacity - 1;
+    size_t i = hash_group(zip, 0, 0) & mask;
+    while (places->slots[i].zip != -1 && places->slots[i].zip != zip) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
 
-    
-    // Instantiate a file pointer
-    FILE* fileP;
-    fileP = fopen(infile, "r");
-    
-    // While File pointer is not null
-    if (fileP != NULL) {
-        int num = 0;
-        int index = 0;
-        while(fscanf(fileP, "%d", &num) != EOF) {
-            data prompt;
-            if (index == 0) {
-                prompt.zip = num;
-                index++;
-            }
-            else if (index == 1) {
-                prompt.month = num;
-                index++;
-            }
-            else if (index == 2) {
-                //Saving zipcode, month and year as given in prompt
-                prompt.year = num;
-                //Resetting index
-                index = 0;
-                output[data_entry_prompts].zip = prompt.zip;
-                output[data_entry_prompts].month = prompt.month;
-                output[data_entry_prompts++].year = prompt.year;
+//Function to check whether a zip already has a location
+static inline int place_known(const place_table * places, int zip) {
+    return places->slots[place_probe(places, zip)].zip == zip;
+}
+
+//Function to record the location of a zip unless it already has one
+void place_add(place_table * places, const place * p) {
+    if ((places->count + 1) * 4 > places->capacity * 3) {
+        place_table bigger;
+        place_init(&bigger, places->capacity * 2);
+        for (size_t i = 0; i < places->capacity; i++) {
+            if (places->slots[i].zip != -1) {
+                bigger.slots[place_probe(&bigger, places->slots[i].zip)] = places->slots[i];
             }
         }
-        fclose(fileP);
-    } 
-    else {
-        //File error condition
-        perror("fopen"); 
-        exit(EXIT_FAILURE); 
+        bigger.count = places->count;
+        place_free(places);
+        *places = bigger;
     }
+    size_t i = place_probe(places, p->zip);
+    if (places->slots[i].zip == -1) {
+        places->slots[i] = *p;
+        places->count++;
+    }
+}
 
-    printf("\n");
-    
-    //Instantiate another object of struct data_entry
-    data * data_entry;
-     
-    //Define buffer 
-    char buffer[256]; 
+//Function to add every location of src that dst does not have yet
+void place_merge(place_table * dst, const place_table * src) {
+    for (size_t i = 0; i < src->capacity; i++) {
+        if (src->slots[i].zip != -1) {
+            place_add(dst, &src->slots[i]);
+        }
+    }
+}
+
+//Function to parse an integer field, empty fields read as 0 like atoi
+int field_int(field f) {
+    size_t i = 0;
+    int sign = 1;
+    int val = 0;
+    if (i < f.len && f.ptr[i] == '-') {
+        sign = -1;
+        i++;
+    }
+    for (; i < f.len && f.ptr[i] >= '0' && f.ptr[i] <= '9'; i++) {
+        val = val * 10 + (f.ptr[i] - '0');
+    }
+    return sign * val;
+}
 
-    for (int i = 0; i < sizeof(buffer); i++){
-        buffer[i] = 'z'; 
+//Function to check a field is a non-empty run of digits (rejects the header row)
+int field_is_number(field f) {
+    if (f.len == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < f.len; i++) {
+        if (f.ptr[i] < '0' || f.ptr[i] > '9') {
+            return 0;
+        }
     }
+    return 1;
+}
 
-    //Define integer to store unique entry count
-    int uniqueCount;
-    char * uniqueRecords[8341];
-    //Allocate memory
-    data_entry = (struct data *)malloc(8341 * sizeof(struct data));
-    int number;
-    for (int i=1; i<no_of_files+1; i++){
-        FILE * fd;
-        char int_str[3];
-        char * name;
-        //Convert i to string
-        sprintf(int_str, "%d", i);
-        name = malloc(sizeof(char)*strlen(filename) + sizeof(char)*strlen(int_str)+ sizeof(char)*strlen(fileext));
-        //Concatenate string to show path location
-        strcat(name, filename);
-        strcat(name, int_str);
-        strcat(name, fileext);
-
-        //File opening
-        fd = fopen(name, "r");
-        if (fd != NULL){
-            char *line = NULL;
-            long int len = 0;
-            long nRead = getline(&line, &len, fd);
-            while ( nRead != -1) {
-                sscanf(line,"%s %d",buffer,&number);  
-                //Call function to start storing unique entries into struct
-                countRecord(buffer, uniqueRecords, &uniqueCount, data_entry, output);
-                //Free line pointer
-                free(line);
-                line = NULL;
-                nRead = getline(&line, &len, fd);
-                }
-        }
-    else{
-        perror("open");
-        return EXIT_FAILURE;
+//Function to check a field holds a MM/DD/YYYY date
+int field_is_date(field f) {
+    static const char pattern[] = "00/00/0000";
+    if (f.len != sizeof(pattern) - 1) {
+        return 0;
     }
-    //Deallocate memory
-    free(name);
-    
+    for (size_t i = 0; i < f.len; i++) {
+        int digit = f.ptr[i] >= '0' && f.ptr[i] <= '9';
+        if (pattern[i] == '0' ? !digit : f.ptr[i] != pattern[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//Tokenizer state carried across delimiters of one row
+typedef struct token_state {
+  const char * start;
+  int count;
+  int quoted;
+} token_state;
+
+//Signature shared by the scalar and vector tokenizers: split the row starting at pos into fields,
+//returns the number of fields seen (which can exceed max, extra fields are not stored)
+//and sets *next to the start of the following row
+typedef int (*tokenizer)(const char * pos, const char * end, field * record, int max, const char ** next);
+
+//Function to store the field [start, stop), dropping the surrounding quotes of a quoted field
+static inline void token_field(token_state * ts, const char * stop, field * record, int max) {
+    if (ts->count < max) {
+        const char * start = ts->start;
+        if (stop - start >= 2 && *start == '"' && stop[-1] == '"') {
+            start++;
+            stop--;
+        }
+        record[ts->count].ptr = start;
+        record[ts->count].len = stop - start;
+    }
+    ts->count++;
+}
+
+//Function to handle one comma, quote or newline at p, returns 1 when it ends the row
+//Commas and newlines inside quotes are part of the field
+static inline int token_step(token_state * ts, const char * p, field * record, int max) {
+    if (*p == '"') {
+        ts->quoted = !ts->quoted;
+        return 0;
+    }
+    if (ts->quoted) {
+        return 0;
+    }
+    const char * stop = p;
+    //Tolerate CRLF line endings
+    if (*p == '\n' && stop > ts->start && stop[-1] == '\r') {
+        stop--;
+    }
+    token_field(ts, stop, record, max);
+    ts->start = p + 1;
+    return *p == '\n';
+}
+
+//Function to finish a row byte by byte from p, shared by every tokenizer for the bytes left over
+static inline int token_tail(token_state * ts, const char * p, const char * end, field * record, int max, const char ** next) {
+    for (; p < end; p++) {
+        if ((*p == ',' || *p == '"' || *p == '\n') && token_step(ts, p, record, max)) {
+            *next = p + 1;
+            return ts->count;
+        }
+    }
+    //Last row without a trailing newline
+    const char * stop = end;
+    if (stop > ts->start && stop[-1] == '\r') {
+        stop--;
+    }
+    token_field(ts, stop, record, max);
+    *next = end;
+    return ts->count;
+}
+
+//Scalar tokenizer, the reference the vector kernels are checked against
+int tokenize_scalar(const char * pos, const char * end, field * record, int max, const char ** next) {
+    token_state ts = {pos, 0, 0};
+    return token_tail(&ts, pos, end, record, max, next);
+}
+
+#ifdef HAVE_X86_SIMD
+//SSE2 tokenizer: compare 16 bytes at a time against comma, quote and newline,
+//then walk the set bits of the match mask in order
+int tokenize_sse2(const char * pos, const char * end, field * record, int max, const char ** next) {
+    token_state ts = {pos, 0, 0};
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const char * p = pos;
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, quote)),
+                                    _mm_cmpeq_epi8(chunk, newline));
+        unsigned mask = _mm_movemask_epi8(hits);
+        while (mask != 0) {
+            const char * hit = p + __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (token_step(&ts, hit, record, max)) {
+                *next = hit + 1;
+                return ts.count;
+            }
+        }
+    }
+    return token_tail(&ts, p, end, record, max, next);
+}
+
+//AVX2 tokenizer: same as the SSE2 kernel over 32 bytes, only used when the CPU reports AVX2
+__attribute__((target("avx2")))
+int tokenize_avx2(const char * pos, const char * end, field * record, int max, const char ** next) {
+    token_state ts = {pos, 0, 0};
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const char * p = pos;
+    for (; end - p >= 32; p += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, comma), _mm256_cmpeq_epi8(chunk, quote)),
+                                       _mm256_cmpeq_epi8(chunk, newline));
+        unsigned mask = _mm256_movemask_epi8(hits);
+        while (mask != 0) {
+            const char * hit = p + __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (token_step(&ts, hit, record, max)) {
+                *next = hit + 1;
+                return ts.count;
+            }
+        }
+    }
+    return token_tail(&ts, p, end, record, max, next);
+}
+#endif
+
+//Tokenizer used for ingestion, picked once at startup by select_tokenizer
+tokenizer tokenize_row = tokenize_scalar;
+
+//Function to pick the widest tokenizer the CPU supports
+void select_tokenizer(void) {
+#ifdef HAVE_X86_SIMD
+    tokenize_row = __builtin_cpu_supports("avx2") ? tokenize_avx2 : tokenize_sse2;
+#endif
+}
+
+//Names and kernels of every tokenizer usable on this machine, scalar first
+int available_tokenizers(const char * names[], tokenizer kernels[]) {
+    int n = 0;
+    names[n] = "scalar";
+    kernels[n++] = tokenize_scalar;
+#ifdef HAVE_X86_SIMD
+    names[n] = "sse2";
+    kernels[n++] = tokenize_sse2;
+    if (__builtin_cpu_supports("avx2")) {
+        names[n] = "avx2";
+        kernels[n++] = tokenize_avx2;
+    }
+#endif
+    return n;
+}
+
+//Function to parse a decimal field such as 1565.6, empty fields read as 0
+double field_double(field f) {
+    size_t i = 0;
+    double sign = 1;
+    double val = 0;
+    double scale = 1;
+    if (i < f.len && f.ptr[i] == '-') {
+        sign = -1;
+        i++;
+    }
+    for (; i < f.len && f.ptr[i] >= '0' && f.ptr[i] <= '9'; i++) {
+        val = val * 10 + (f.ptr[i] - '0');
+    }
+    if (i < f.len && f.ptr[i] == '.') {
+        for (i++; i < f.len && f.ptr[i] >= '0' && f.ptr[i] <= '9'; i++) {
+            val = val * 10 + (f.ptr[i] - '0');
+            scale *= 10;
+        }
+    }
+    return sign * (val / scale);
+}
+
+//Function to parse a decimal field into single precision, as stored in the cache columns
+float field_float(field f) {
+    return (float)field_double(f);
+}
+
+//Function to parse a "POINT (lon lat)" field, returns -1 for an empty or malformed location
+int field_point(field f, float * lon, float * lat) {
+    size_t open = 0;
+    while (open < f.len && f.ptr[open] != '(') {
+        open++;
+    }
+    size_t space = open + 1;
+    while (space < f.len && f.ptr[space] != ' ') {
+        space++;
+    }
+    size_t close = space + 1;
+    while (close < f.len && f.ptr[close] != ')') {
+        close++;
+    }
+    if (close >= f.len || space == open + 1 || close == space + 1) {
+        return -1;
+    }
+    field x = {f.ptr + open + 1, space - open - 1};
+    field y = {f.ptr + space + 1, close - space - 1};
+    *lon = field_float(x);
+    *lat = field_float(y);
+    return 0;
+}
+
+//Function to record the location of a row's zip the first time the zip is seen
+static inline void place_note(place_table * places, int zip, field location) {
+    place p = {zip, 0, 0};
+    if (!place_known(places, zip) && field_point(location, &p.lon, &p.lat) == 0) {
+        place_add(places, &p);
+    }
+}
+
+//Function for data entry into struct data * data_entry
+int data_entry_struct(const record_key * key, data * data_entry){
+    int mday;
+    data_entry->zip = key->zip;
+    day_to_date(key->day, &data_entry->year, &data_entry->month, &mday);
+    data_entry->cases = key->cases;
+    data_entry->tests = key->tests;
+    data_entry->deaths = key->deaths;
+    return 0;
+}
+
+//Function to allocate an empty store
+void store_init(store * st) {
+    arena_init(&st->pool, 4 << 20);
+    set_init(&st->keys, 1024, &st->pool);
+    group_init(&st->groups, 1024);
+    place_init(&st->places, 64);
+    st->bytes = 0;
+    memset(&st->stats, 0, sizeof(st->stats));
+}
+
+void store_free(store * st) {
+    set_free(&st->keys);
+    group_free(&st->groups);
+    place_free(&st->places);
+    arena_free(&st->pool);
 }
-//Iterate over input file to find prompts
-for (int m=0; m<data_entry_prompts; m++){
-    //Call compute function
-    compute(output[m].zip, output[m].month, output[m].year, m, uniqueCount, data_entry, output);
+
+//Function to get the number of unique records in a store
+static inline size_t store_count(const store * st) {
+    return st->keys.records.count;
 }
-//Call function to write to outfile
-write_file(output, outfile, data_entry_prompts);
 
-//Free open pointers
-free(data_entry);
-free(output);
+//Function to insert a record if its key is new, the aggregate is left untouched (see store_add)
+int store_insert(store * st, const record_key * key) {
+    return set_insert(&st->keys, key);
 }
 
+//Function to insert a record if its key is new and sum it into its (zip, month, year) group
+int store_add(store * st, const record_key * key, data * record) {
+    if (store_insert(st, key) != 1) {
+        return -1;
+    }
+    group_add(&st->groups, record);
+    return 1;
+}
 
+//Function to add one parsed row to a store, dropping it if its key was already seen
+int store_row(store * st, const record_key * key) {
+    data entry;
+    data_entry_struct(key, &entry);
+    return store_add(st, key, &entry);
+}
 
+//Function to order zips
+int compare_zip(const void * a, const void * b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
 
+//Function to order records by week start only
+int compare_day(const void * a, const void * b) {
+    const record_key * x = a;
+    const record_key * y = b;
+    return (x->day > y->day) - (x->day < y->day);
+}
 
+//Function to fold sorted records into prefix-sum points, one per distinct day
+//Records sharing a day (revised counts for the same week) are summed; returns the number of points
+size_t series_fold(const record_key * sorted, size_t n, series_point * points) {
+    size_t count = 0;
+    long long cases = 0;
+    long long tests = 0;
+    long long deaths = 0;
+    for (size_t i = 0; i < n; i++) {
+        cases += sorted[i].cases;
+        tests += sorted[i].tests;
+        deaths += sorted[i].deaths;
+        if (count == 0 || points[count - 1].day != sorted[i].day) {
+            count++;
+        }
+        points[count - 1].day = sorted[i].day;
+        points[count - 1].cases = cases;
+        points[count - 1].tests = tests;
+        points[count - 1].deaths = deaths;
+    }
+    return count;
+}
+
+//Function to number the month of a group as year * 12 + month - 1
+static inline int month_number(const data * group) {
+    return group->year * 12 + group->month - 1;
+}
+
+//Function to order groups by month, then zip
+int compare_month(const void * a, const void * b) {
+    const data * x = a;
+    const data * y = b;
+    if (month_number(x) != month_number(y)) {
+        return month_number(x) < month_number(y) ? -1 : 1;
+    }
+    return (x->zip > y->zip) - (x->zip < y->zip);
+}
+
+//Function to find the grid column (or row, for latitude) of a coordinate, clamped to the grid
+static inline int grid_cell(const series_index * series, double v, int is_lat) {
+    double c = is_lat ? (v - series->min_lat) / series->cell_lat : (v - series->min_lon) / series->cell_lon;
+    if (c < 0) {
+        return 0;
+    }
+    return c >= series->grid ? series->grid - 1 : (int)c;
+}
+
+//Function to build the per-zip and all-zip weekly prefix-sum series of a store
+void series_build(store * st, series_index * series) {
+    const record_set * set = &st->keys;
+    size_t n = store_count(st);
+    record_key * sorted = malloc((n + 1) * sizeof(record_key));
+    series->points = malloc((n + 1) * sizeof(series_point));
+    series->all = malloc((n + 1) * sizeof(series_point));
+    if (sorted == NULL || series->points == NULL || series->all == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    //Every zip over the whole timeline: days are 16 bit, so each record is summed straight into its day
+    //with one pass over the day and count columns, no sort needed
+    int first = UINT16_MAX;
+    int last = 0;
+    for (size_t c = 0; c < set->records.nchunks; c++) {
+        record_columns cols = set_columns(set, c);
+        size_t m = n - c * CHUNK_ELEMS < CHUNK_ELEMS ? n - c * CHUNK_ELEMS : CHUNK_ELEMS;
+        for (size_t o = 0; o < m; o++) {
+            first = cols.days[o] < first ? cols.days[o] : first;
+            last = cols.days[o] > last ? cols.days[o] : last;
+        }
+    }
+    size_t span = n > 0 ? (size_t)(last - first + 1) : 0;
+    series_point * by_day = calloc(span + 1, sizeof(series_point));
+    unsigned char * present = calloc(span + 1, 1);
+    if (by_day == NULL || present == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t c = 0; c < set->records.nchunks; c++) {
+        record_columns cols = set_columns(set, c);
+        size_t m = n - c * CHUNK_ELEMS < CHUNK_ELEMS ? n - c * CHUNK_ELEMS : CHUNK_ELEMS;
+        for (size_t o = 0; o < m; o++) {
+            series_point * p = &by_day[cols.days[o] - first];
+            p->cases += cols.cases[o];
+            p->tests += cols.tests[o];
+            p->deaths += cols.deaths[o];
+            present[cols.days[o] - first] = 1;
+        }
+    }
+    series->nall = 0;
+    long long cases = 0;
+    long long tests = 0;
+    long long deaths = 0;
+    for (size_t d = 0; d < span; d++) {
+        if (present[d]) {
+            cases += by_day[d].cases;
+            tests += by_day[d].tests;
+            deaths += by_day[d].deaths;
+            series->all[series->nall++] = (series_point){first + (int)d, cases, tests, deaths};
+        }
+    }
+    free(by_day);
+    free(present);
+
+    //One run per zip, each folded on its own so prefix sums restart at every zip
+    //Counting sort on the zip id column: count each zip's records, turn the counts into run offsets in zip order,
+    //then scatter the records into their runs, which are only sorted by day within each zip
+    int nzips = set->nzips;
+    series->nzips = nzips;
+    series->zips = malloc((nzips + 1) * sizeof(int));
+    series->offsets = malloc((nzips + 1) * sizeof(size_t));
+    int * rank = malloc((nzips + 1) * sizeof(int));
+    size_t * run = calloc(nzips + 1, sizeof(size_t));
+    if (series->zips == NULL || series->offsets == NULL || rank == NULL || run == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(series->zips, set->zips, nzips * sizeof(int));
+    qsort(series->zips, nzips, sizeof(int), compare_zip);
+    for (int z = 0; z < nzips; z++) {
+        rank[zip_find(set, series->zips[z])] = z;
+    }
+    for (size_t c = 0; c < set->records.nchunks; c++) {
+        record_columns cols = set_columns(set, c);
+        size_t m = n - c * CHUNK_ELEMS < CHUNK_ELEMS ? n - c * CHUNK_ELEMS : CHUNK_ELEMS;
+        for (size_t o = 0; o < m; o++) {
+            run[rank[cols.zip_ids[o]] + 1]++;
+        }
+    }
+    for (int z = 0; z < nzips; z++) {
+        run[z + 1] += run[z];
+    }
+    for (size_t c = 0; c < set->records.nchunks; c++) {
+        record_columns cols = set_columns(set, c);
+        size_t m = n - c * CHUNK_ELEMS < CHUNK_ELEMS ? n - c * CHUNK_ELEMS : CHUNK_ELEMS;
+        for (size_t o = 0; o < m; o++) {
+            int id = cols.zip_ids[o];
+            sorted[run[rank[id]]++] = (record_key){set->zips[id], cols.days[o], cols.cases[o], cols.tests[o], cols.deaths[o]};
+        }
+    }
+    //Scattering moved each offset to the end of its run, the previous one is where the run starts
+    size_t points = 0;
+    for (int z = 0; z < nzips; z++) {
+        size_t begin = z > 0 ? run[z - 1] : 0;
+        qsort(sorted + begin, run[z] - begin, sizeof(record_key), compare_day);
+        series->offsets[z] = points;
+        points += series_fold(sorted + begin, run[z] - begin, series->points + points);
+    }
+    series->offsets[nzips] = points;
+    free(rank);
+    free(run);
+    free(sorted);
+
+    //The groups of each month side by side, so a ranking only reads its own month
+    size_t ngroups = st->groups.count;
+    series->month_groups = malloc((ngroups + 1) * sizeof(data));
+    if (series->month_groups == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    size_t g = 0;
+    for (size_t i = 0; i < st->groups.capacity; i++) {
+        if (st->groups.used[i]) {
+            series->month_groups[g++] = st->groups.slots[i];
+        }
+    }
+    qsort(series->month_groups, ngroups, sizeof(data), compare_month);
+    int nmonths = 0;
+    for (size_t i = 0; i < ngroups; i++) {
+        nmonths += i == 0 || month_number(&series->month_groups[i]) != month_number(&series->month_groups[i - 1]);
+    }
+    series->nmonths = nmonths;
+    series->months = malloc((nmonths + 1) * sizeof(int));
+    series->month_offsets = malloc((nmonths + 1) * sizeof(size_t));
+    if (series->months == NULL || series->month_offsets == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int m = 0;
+    for (size_t i = 0; i < ngroups; i++) {
+        if (i == 0 || month_number(&series->month_groups[i]) != month_number(&series->month_groups[i - 1])) {
+            series->months[m] = month_number(&series->month_groups[i]);
+            series->month_offsets[m++] = i;
+        }
+    }
+    series->month_offsets[m] = ngroups;
+
+    //Zip locations bucketed into a uniform grid of about one zip per cell
+    const place_table * places = &st->places;
+    int nplaces = places->count;
+    int grid = 1;
+    while ((grid + 1) * (grid + 1) <= nplaces) {
+        grid++;
+    }
+    series->nplaces = nplaces;
+    series->grid = grid;
+    series->places = malloc((nplaces + 1) * sizeof(place));
+    series->cells = calloc((size_t)grid * grid + 1, sizeof(size_t));
+    int * cell_of = malloc((nplaces + 1) * sizeof(int));
+    if (series->places == NULL || series->cells == NULL || cell_of == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    double max_lon = 0;
+    double max_lat = 0;
+    int seen = 0;
+    for (size_t i = 0; i < places->capacity; i++) {
+        const place * p = &places->slots[i];
+        if (p->zip == -1) {
+            continue;
+        }
+        if (seen++ == 0) {
+            series->min_lon = max_lon = p->lon;
+            series->min_lat = max_lat = p->lat;
+        }
+        series->min_lon = p->lon < series->min_lon ? p->lon : series->min_lon;
+        series->min_lat = p->lat < series->min_lat ? p->lat : series->min_lat;
+        max_lon = p->lon > max_lon ? p->lon : max_lon;
+        max_lat = p->lat > max_lat ? p->lat : max_lat;
+    }
+    series->cell_lon = max_lon > series->min_lon ? (max_lon - series->min_lon) / grid : 1;
+    series->cell_lat = max_lat > series->min_lat ? (max_lat - series->min_lat) / grid : 1;
+    //Counting sort by cell: count, turn counts into offsets, then place
+    int placed = 0;
+    for (size_t i = 0; i < places->capacity; i++) {
+        const place * p = &places->slots[i];
+        if (p->zip != -1) {
+            cell_of[placed] = grid_cell(series, p->lat, 1) * grid + grid_cell(series, p->lon, 0);
+            series->cells[cell_of[placed++] + 1]++;
+        }
+    }
+    for (int c = 0; c < grid * grid; c++) {
+        series->cells[c + 1] += series->cells[c];
+    }
+    size_t * fill = malloc(((size_t)grid * grid + 1) * sizeof(size_t));
+    if (fill == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(fill, series->cells, ((size_t)grid * grid + 1) * sizeof(size_t));
+    placed = 0;
+    for (size_t i = 0; i < places->capacity; i++) {
+        if (places->slots[i].zip != -1) {
+            series->places[fill[cell_of[placed++]]++] = places->slots[i];
+        }
+    }
+    free(fill);
+    free(cell_of);
+}
+
+void series_free(series_index * series) {
+    free(series->zips);
+    free(series->offsets);
+    free(series->points);
+    free(series->all);
+    free(series->months);
+    free(series->month_offsets);
+    free(series->month_groups);
+    free(series->places);
+    free(series->cells);
+}
+
+//Function to find the first point with day >= day in points[0..n)
+size_t series_lower(const series_point * points, size_t n, int day) {
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (points[mid].day < day) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+//Function to sum the weeks starting in [start, end] of one series from its prefix sums
+void series_sum(const series_point * points, size_t n, int start, int end, query * q) {
+    size_t lo = series_lower(points, n, start);
+    size_t hi = series_lower(points, n, end + 1);
+    q->cases = q->tests = q->deaths = 0;
+    if (hi > lo) {
+        q->cases = points[hi - 1].cases - (lo > 0 ? points[lo - 1].cases : 0);
+        q->tests = points[hi - 1].tests - (lo > 0 ? points[lo - 1].tests : 0);
+        q->deaths = points[hi - 1].deaths - (lo > 0 ? points[lo - 1].deaths : 0);
+    }
+}
+
+//Function to answer a date-range query with two binary searches (plus one to find the zip)
+void series_range(const series_index * series, query * q) {
+    if (q->zip == ALL_ZIPS) {
+        series_sum(series->all, series->nall, q->start, q->end, q);
+        return;
+    }
+    int lo = 0;
+    int hi = series->nzips;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (series->zips[mid] < q->zip) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if (lo == series->nzips || series->zips[lo] != q->zip) {
+        q->cases = q->tests = q->deaths = 0;
+        return;
+    }
+    size_t first = series->offsets[lo];
+    series_sum(series->points + first, series->offsets[lo + 1] - first, q->start, q->end, q);
+}
+
+//Function to check a token is an optionally signed decimal integer
+int token_is_int(const char * token) {
+    field f = {token + (token[0] == '-'), strlen(token) - (token[0] == '-')};
+    return field_is_number(f);
+}
+
+//Function to check a token is a MM/DD/YYYY date
+int token_is_date(const char * token) {
+    field f = {token, strlen(token)};
+    return field_is_date(f);
+}
+
+//Function to get the number of tokens a prompt starting with first takes: 5 for a ranking prompt,
+//9 for a bounding box, 8 for a radius, else 3
+int query_tokens(const char * first) {
+    if (strcmp(first, "top") == 0 || strcmp(first, "bottom") == 0) {
+        return 5;
+    }
+    return strcmp(first, "box") == 0 ? 9 : strcmp(first, "radius") == 0 ? 8 : 3;
+}
+
+//Function to check a token is a decimal number and parse it into *value
+int token_double(const char * token, double * value) {
+    char * end;
+    *value = strtod(token, &end);
+    return end != token && *end == '\0' && isfinite(*value);
+}
+
+//Function to parse the "month year month year" tail of a spatial prompt into the day range it covers
+int parse_months(char tokens[][64], query * q) {
+    for (int t = 0; t < 4; t++) {
+        if (!token_is_int(tokens[t])) {
+            return -1;
+        }
+    }
+    int m1 = atoi(tokens[0]);
+    int y1 = atoi(tokens[1]);
+    int m2 = atoi(tokens[2]);
+    int y2 = atoi(tokens[3]);
+    if (m1 < 1 || m1 > 12 || m2 < 1 || m2 > 12 || y2 * 12 + m2 < y1 * 12 + m1) {
+        return -1;
+    }
+    q->start = civil_day(y1, m1, 1);
+    q->end = civil_day(y2 + (m2 == 12), m2 % 12 + 1, 1) - 1;
+    return 0;
+}
+
+//Function to parse a prompt from its tokens, either "zip month year", "zip start_date end_date"
+//with MM/DD/YYYY dates and * for every zip, "heavy K metric", "distinct zips week_start|*",
+//"top|bottom K metric month year",
+//"box lon1 lat1 lon2 lat2 month year month year" or "radius lon lat km month year month year";
+//returns -1 if malformed
+int parse_query(char tokens[][64], int ntokens, query * q) {
+    memset(q, 0, sizeof(query));
+    if (ntokens != query_tokens(tokens[0])) {
+        return -1;
+    }
+    if (ntokens == 9) {
+        q->kind = QUERY_BOX;
+        if (!token_double(tokens[1], &q->lon1) || !token_double(tokens[2], &q->lat1)
+            || !token_double(tokens[3], &q->lon2) || !token_double(tokens[4], &q->lat2)
+            || parse_months(tokens + 5, q) != 0) {
+            return -1;
+        }
+        //Corners may come in any order
+        if (q->lon1 > q->lon2) {
+            double t = q->lon1;
+            q->lon1 = q->lon2;
+            q->lon2 = t;
+        }
+        if (q->lat1 > q->lat2) {
+            double t = q->lat1;
+            q->lat1 = q->lat2;
+            q->lat2 = t;
+        }
+        return 0;
+    }
+    if (ntokens == 8) {
+        q->kind = QUERY_RADIUS;
+        if (!token_double(tokens[1], &q->lon1) || !token_double(tokens[2], &q->lat1)
+            || !token_double(tokens[3], &q->radius) || q->radius < 0 || parse_months(tokens + 4, q) != 0) {
+            return -1;
+        }
+        return 0;
+    }
+    if (ntokens == 5) {
+        q->kind = strcmp(tokens[0], "top") == 0 ? QUERY_TOP : QUERY_BOTTOM;
+        q->metric = -1;
+        for (int m = 0; m < NO_OF_METRICS; m++) {
+            if (strcmp(tokens[2], metric_names[m]) == 0) {
+                q->metric = m;
+            }
+        }
+        if (!token_is_int(tokens[1]) || atoi(tokens[1]) < 1 || q->metric < 0
+            || !token_is_int(tokens[3]) || !token_is_int(tokens[4])) {
+            return -1;
+        }
+        q->k = atoi(tokens[1]);
+        q->month = atoi(tokens[3]);
+        q->year = atoi(tokens[4]);
+        return 0;
+    }
+    const char * a = tokens[0];
+    const char * b = tokens[1];
+    const char * c = tokens[2];
+    if (strcmp(a, "heavy") == 0) {
+        q->kind = QUERY_HEAVY;
+        q->metric = -1;
+        for (int m = 0; m < METRIC_POSITIVITY; m++) {
+            if (strcmp(c, metric_names[m]) == 0) {
+                q->metric = m;
+            }
+        }
+        if (!token_is_int(b) || atoi(b) < 1 || q->metric < 0) {
+            return -1;
+        }
+        q->k = atoi(b);
+        return 0;
+    }
+    if (strcmp(a, "distinct") == 0) {
+        q->kind = QUERY_DISTINCT;
+        if (strcmp(b, "zips") != 0 || (strcmp(c, "*") != 0 && !token_is_date(c))) {
+            return -1;
+        }
+        q->zip = strcmp(c, "*") == 0 ? ALL_ZIPS : 0;
+        q->start = q->zip == ALL_ZIPS ? 0 : get_day(c);
+        return 0;
+    }
+    if (strchr(b, '/') != NULL) {
+        if ((strcmp(a, "*") != 0 && !token_is_int(a)) || !token_is_date(b) || !token_is_date(c)) {
+            return -1;
+        }
+        q->kind = QUERY_RANGE;
+        q->zip = strcmp(a, "*") == 0 ? ALL_ZIPS : atoi(a);
+        q->start = get_day(b);
+        q->end = get_day(c);
+        return 0;
+    }
+    if (!token_is_int(a) || !token_is_int(b) || !token_is_int(c)) {
+        return -1;
+    }
+    q->kind = QUERY_MONTH;
+    q->zip = atoi(a);
+    q->month = atoi(b);
+    q->year = atoi(c);
+    return 0;
+}
+
+//Function to check whether entry a ranks ahead of entry b, ties go to the lower zip
+static inline int rank_ahead(const rank_entry * a, const rank_entry * b, int descending) {
+    if (a->value != b->value) {
+        return descending ? a->value > b->value : a->value < b->value;
+    }
+    return a->zip < b->zip;
+}
+
+//Function to restore the heap below slot i; the root is the entry ranked last, so it is the one to evict
+void rank_sift_down(rank_entry * heap, int n, int i, int descending) {
+    for (;;) {
+        int last = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        if (l < n && rank_ahead(&heap[last], &heap[l], descending)) {
+            last = l;
+        }
+        if (r < n && rank_ahead(&heap[last], &heap[r], descending)) {
+            last = r;
+        }
+        if (last == i) {
+            return;
+        }
+        rank_entry t = heap[i];
+        heap[i] = heap[last];
+        heap[last] = t;
+        i = last;
+    }
+}
+
+//Function to offer entry e to a bounded ranking heap of at most cap entries holding *n
+void rank_push(rank_entry * heap, int * n, int cap, const rank_entry * e, int descending) {
+    if (*n < cap) {
+        //Sift up: the heap keeps its last-ranked entry at the root
+        int c = (*n)++;
+        heap[c] = *e;
+        while (c > 0 && rank_ahead(&heap[(c - 1) / 2], &heap[c], descending)) {
+            rank_entry t = heap[c];
+            heap[c] = heap[(c - 1) / 2];
+            heap[(c - 1) / 2] = t;
+            c = (c - 1) / 2;
+        }
+    }
+    else if (*n > 0 && rank_ahead(e, &heap[0], descending)) {
+        heap[0] = *e;
+        rank_sift_down(heap, *n, 0, descending);
+    }
+}
+
+//Function to sort a ranking heap in place into rank order
+void rank_finish(rank_entry * heap, int n, int descending) {
+    //Pop the root into the back each time, leaving the entries in rank order
+    for (int last = n - 1; last > 0; last--) {
+        rank_entry t = heap[0];
+        heap[0] = heap[last];
+        heap[last] = t;
+        rank_sift_down(heap, last, 0, descending);
+    }
+}
+
+//Function to rank the zips of a month with one pass over that month's groups in the series index
+//Only the k best groups are kept, in a bounded heap, and only those k are sorted at the end
+void rank_groups(const series_index * series, query * q) {
+    int descending = q->kind == QUERY_TOP;
+    //Binary search for the month, an absent month ranks nothing
+    int target = q->year * 12 + q->month - 1;
+    int lo = 0;
+    int hi = series->nmonths;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (series->months[mid] < target) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    size_t first = 0;
+    size_t last = 0;
+    if (lo < series->nmonths && series->months[lo] == target && q->month >= 1 && q->month <= 12) {
+        first = series->month_offsets[lo];
+        last = series->month_offsets[lo + 1];
+    }
+    int cap = (size_t)q->k < last - first ? q->k : (int)(last - first);
+    rank_entry * heap = malloc((cap > 0 ? cap : 1) * sizeof(rank_entry));
+    if (heap == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int n = 0;
+    for (size_t i = first; i < last; i++) {
+        const data * g = &series->month_groups[i];
+        rank_entry e = {g->zip, 0};
+        if (q->metric == METRIC_POSITIVITY) {
+            //A month without tests has no positivity and is left out
+            if (g->tests <= 0) {
+                continue;
+            }
+            e.value = (double)g->cases / g->tests;
+        }
+        else {
+            e.value = q->metric == METRIC_CASES ? g->cases : q->metric == METRIC_TESTS ? g->tests : g->deaths;
+        }
+        rank_push(heap, &n, cap, &e, descending);
+    }
+    rank_finish(heap, n, descending);
+    q->ranked = heap;
+    q->nranked = n;
+}
+
+//Function to rank every zip by its total over the whole data, from the last prefix sum of each zip's series
+void heavy_exact(const series_index * series, query * q) {
+    int cap = q->k < series->nzips ? q->k : series->nzips;
+    rank_entry * heap = malloc((cap > 0 ? cap : 1) * sizeof(rank_entry));
+    if (heap == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int n = 0;
+    for (int z = 0; z < series->nzips; z++) {
+        const series_point * total = &series->points[series->offsets[z + 1] - 1];
+        rank_entry e = {series->zips[z], q->metric == METRIC_CASES ? total->cases
+                        : q->metric == METRIC_TESTS ? total->tests : total->deaths};
+        rank_push(heap, &n, cap, &e, 1);
+    }
+    rank_finish(heap, n, 1);
+    q->ranked = heap;
+    q->nranked = n;
+}
+
+//Function to count the zips with a row for the week starting on q->start, or the zips overall for ALL_ZIPS
+void distinct_exact(const series_index * series, query * q) {
+    q->matched = 0;
+    for (int z = 0; z < series->nzips; z++) {
+        const series_point * points = series->points + series->offsets[z];
+        size_t n = series->offsets[z + 1] - series->offsets[z];
+        size_t i = series_lower(points, n, q->start);
+        q->matched += q->zip == ALL_ZIPS || (i < n && points[i].day == q->start);
+    }
+}
+
+//Function to get the great-circle distance in km between two points given in degrees
+double distance_km(double lon1, double lat1, double lon2, double lat2) {
+    double rad = M_PI / 180;
+    double dlat = (lat2 - lat1) * rad;
+    double dlon = (lon2 - lon1) * rad;
+    double a = sin(dlat / 2) * sin(dlat / 2) + cos(lat1 * rad) * cos(lat2 * rad) * sin(dlon / 2) * sin(dlon / 2);
+    return 2 * 6371.0088 * asin(sqrt(a < 1 ? a : 1));
+}
+
+//Function to sum the month range of a spatial prompt over every zip inside its box or circle
+//Only grid cells overlapping the bounding box are visited; each matching zip is one prefix-sum lookup
+void answer_spatial(const series_index * series, query * q) {
+    double lon_lo = q->lon1;
+    double lon_hi = q->lon2;
+    double lat_lo = q->lat1;
+    double lat_hi = q->lat2;
+    if (q->kind == QUERY_RADIUS) {
+        //Degrees spanned by the radius, widened in longitude by the latitude of the farthest edge
+        double dlat = q->radius / 111.195;
+        double edge = fabs(q->lat1) + dlat < 89 ? fabs(q->lat1) + dlat : 89;
+        double dlon = dlat / cos(edge * M_PI / 180);
+        lon_lo = q->lon1 - dlon;
+        lon_hi = q->lon1 + dlon;
+        lat_lo = q->lat1 - dlat;
+        lat_hi = q->lat1 + dlat;
+    }
+    long long cases = 0;
+    long long tests = 0;
+    long long deaths = 0;
+    int matched = 0;
+    if (series->nplaces > 0) {
+        int x0 = grid_cell(series, lon_lo, 0);
+        int x1 = grid_cell(series, lon_hi, 0);
+        int y0 = grid_cell(series, lat_lo, 1);
+        int y1 = grid_cell(series, lat_hi, 1);
+        for (int y = y0; y <= y1; y++) {
+            for (size_t i = series->cells[y * series->grid + x0]; i < series->cells[y * series->grid + x1 + 1]; i++) {
+                const place * p = &series->places[i];
+                int inside = q->kind == QUERY_BOX
+                    ? p->lon >= lon_lo && p->lon <= lon_hi && p->lat >= lat_lo && p->lat <= lat_hi
+                    : distance_km(q->lon1, q->lat1, p->lon, p->lat) <= q->radius;
+                if (!inside) {
+                    continue;
+                }
+                query zip = *q;
+                zip.zip = p->zip;
+                series_range(series, &zip);
+                cases += zip.cases;
+                tests += zip.tests;
+                deaths += zip.deaths;
+                matched++;
+            }
+        }
+    }
+    q->cases = cases;
+    q->tests = tests;
+    q->deaths = deaths;
+    q->matched = matched;
+}
+
+//Function to release the ranking held by an answered prompt
+void query_free(query * q) {
+    free(q->ranked);
+    q->ranked = NULL;
+    q->nranked = 0;
+}
+
+//Function to answer a prompt; every kind but the plain month needs the series index
+void answer_query(query * q, store * dataset, const series_index * series) {
+    if (q->kind == QUERY_RANGE) {
+        series_range(series, q);
+        return;
+    }
+    if (q->kind == QUERY_TOP || q->kind == QUERY_BOTTOM) {
+        rank_groups(series, q);
+        return;
+    }
+    if (q->kind == QUERY_BOX || q->kind == QUERY_RADIUS) {
+        answer_spatial(series, q);
+        return;
+    }
+    if (q->kind == QUERY_HEAVY) {
+        heavy_exact(series, q);
+        return;
+    }
+    if (q->kind == QUERY_DISTINCT) {
+        distinct_exact(series, q);
+        return;
+    }
+    data result;
+    compute(q->zip, q->month, q->year, 0, &dataset->groups, &result);
+    q->cases = result.cases;
+    q->tests = result.tests;
+    q->deaths = result.deaths;
+}
+
+//Function to print the error bound of an approximate answer, nothing for an exact one
+void print_bound(FILE * fout, const query * result) {
+    if (!result->approximate) {
+        return;
+    }
+    if (result->kind == QUERY_DISTINCT) {
+        fprintf(fout, " (about +-%lld)", result->bound[0]);
+    }
+    else if (result->kind == QUERY_HEAVY) {
+        fprintf(fout, " (each at most %lld over)", result->bound[0]);
+    }
+    else if (result->under[0] != 0 || result->under[1] != 0 || result->under[2] != 0) {
+        fprintf(fout, " (at most %lld,%lld,%lld over, %lld,%lld,%lld under)", result->bound[0], result->bound[1],
+                result->bound[2], result->under[0], result->under[1], result->under[2]);
+    }
+    else {
+        fprintf(fout, " (at most %lld,%lld,%lld over)", result->bound[0], result->bound[1], result->bound[2]);
+    }
+}
+
+//Function to print one answer as "zip month year = cases,tests,deaths"
+//or "zip start_date end_date = cases,tests,deaths" for a range
+//or "top K metric month year = zip:value zip:value ..." for a ranking, best first (likewise "heavy K metric")
+//or "distinct zips week_start = N"
+//or the spatial prompt followed by "= cases,tests,deaths in N zips"
+//Approximate answers end with their error bound in parentheses
+void print_result(FILE * fout, query * result) {
+    if (result->kind == QUERY_DISTINCT) {
+        fprintf(fout, "distinct zips ");
+        if (result->zip == ALL_ZIPS) {
+            fprintf(fout, "*");
+        }
+        else {
+            print_date(fout, result->start);
+        }
+        fprintf(fout, " = %d", result->matched);
+        print_bound(fout, result);
+        fprintf(fout, "\n");
+        return;
+    }
+    if (result->kind == QUERY_BOX || result->kind == QUERY_RADIUS) {
+        int y1, m1, y2, m2, d;
+        day_to_date(result->start, &y1, &m1, &d);
+        day_to_date(result->end, &y2, &m2, &d);
+        if (result->kind == QUERY_BOX) {
+            fprintf(fout, "box %.6f %.6f %.6f %.6f", result->lon1, result->lat1, result->lon2, result->lat2);
+        }
+        else {
+            fprintf(fout, "radius %.6f %.6f %g", result->lon1, result->lat1, result->radius);
+        }
+        fprintf(fout, " %d %d %d %d = %lld,%lld,%lld in %d zips\n", m1, y1, m2, y2,
+                result->cases, result->tests, result->deaths, result->matched);
+        return;
+    }
+    if (result->kind == QUERY_HEAVY) {
+        fprintf(fout, "heavy %d %s =", result->k, metric_names[result->metric]);
+    }
+    if (result->kind == QUERY_TOP || result->kind == QUERY_BOTTOM) {
+        fprintf(fout, "%s %d %s %d %d =", result->kind == QUERY_TOP ? "top" : "bottom", result->k,
+                metric_names[result->metric], result->month, result->year);
+    }
+    if (result->kind == QUERY_TOP || result->kind == QUERY_BOTTOM || result->kind == QUERY_HEAVY) {
+        for (int i = 0; i < result->nranked; i++) {
+            if (result->metric == METRIC_POSITIVITY) {
+                fprintf(fout, " %d:%.4f", result->ranked[i].zip, result->ranked[i].value);
+            }
+            else {
+                fprintf(fout, " %d:%.0f", result->ranked[i].zip, result->ranked[i].value);
+            }
+        }
+        print_bound(fout, result);
+        fprintf(fout, "\n");
+        return;
+    }
+    if (result->kind == QUERY_RANGE) {
+        if (result->zip == ALL_ZIPS) {
+            fprintf(fout, "* ");
+        }
+        else {
+            fprintf(fout, "%d ", result->zip);
+        }
+        print_date(fout, result->start);
+        fprintf(fout, " ");
+        print_date(fout, result->end);
+    }
+    else {
+        fprintf(fout, "%d %d %d", result->zip, result->month, result->year);
+    }
+    fprintf(fout, " = %lld,%lld,%lld", result->cases, result->tests, result->deaths);
+    print_bound(fout, result);
+    fprintf(fout, "\n");
+}
+
+//Function to write to outfile
+void write_file(query* output, const char* path, int size) {
+    FILE * fout;
+    fout = fopen(path, "w");
+    if (fout != NULL) {
+        for (int i = 0; i < size; i++) {
+            print_result(fout, &output[i]);
+        }
+        fclose(fout); 
+    } 
+    else {
+        perror("fopen"); 
+        exit(EXIT_FAILURE);
+    }
+}
+
+//Function to stream the rolling series of every zip to path as CSV, one row per zip and week start
+//Each zip's weeks are walked once: the window sums take in the new week and drop the weeks that fall
+//out of the last window weeks, the week-over-week delta compares with the week starting 7 days earlier
+//and the cumulative totals are the zip's prefix sums
+void write_rolling(const series_index * series, const char * path, int window) {
+    FILE * fout = fopen(path, "w");
+    if (fout == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(fout, NULL, _IOFBF, 1 << 20);
+    fprintf(fout, "zip,week_start,cases,tests,deaths,cases_avg%d,tests_avg%d,deaths_avg%d,"
+            "cases_wow,tests_wow,deaths_wow,cases_cum,tests_cum,deaths_cum\n", window, window, window);
+    for (int z = 0; z < series->nzips; z++) {
+        const series_point * points = series->points + series->offsets[z];
+        size_t n = series->offsets[z + 1] - series->offsets[z];
+        long long sum[3] = {0, 0, 0};
+        long long last[3] = {0, 0, 0};
+        size_t oldest = 0;
+        for (size_t i = 0; i < n; i++) {
+            long long week[3] = {points[i].cases, points[i].tests, points[i].deaths};
+            if (i > 0) {
+                week[0] -= points[i - 1].cases;
+                week[1] -= points[i - 1].tests;
+                week[2] -= points[i - 1].deaths;
+            }
+            for (int m = 0; m < 3; m++) {
+                sum[m] += week[m];
+            }
+            //Drop the weeks that started window weeks or more before this one
+            while (points[oldest].day <= points[i].day - 7 * window) {
+                sum[0] -= points[oldest].cases - (oldest > 0 ? points[oldest - 1].cases : 0);
+                sum[1] -= points[oldest].tests - (oldest > 0 ? points[oldest - 1].tests : 0);
+                sum[2] -= points[oldest].deaths - (oldest > 0 ? points[oldest - 1].deaths : 0);
+                oldest++;
+            }
+            double weeks = (double)(i - oldest + 1);
+            fprintf(fout, "%d,", series->zips[z]);
+            print_date(fout, points[i].day);
+            fprintf(fout, ",%lld,%lld,%lld,%.2f,%.2f,%.2f,", week[0], week[1], week[2],
+                    sum[0] / weeks, sum[1] / weeks, sum[2] / weeks);
+            //The delta is left empty when the zip has no row for the previous week
+            if (i > 0 && points[i - 1].day == points[i].day - 7) {
+                fprintf(fout, "%lld,%lld,%lld,", week[0] - last[0], week[1] - last[1], week[2] - last[2]);
+            }
+            else {
+                fprintf(fout, ",,,");
+            }
+            fprintf(fout, "%lld,%lld,%lld\n", points[i].cases, points[i].tests, points[i].deaths);
+            memcpy(last, week, sizeof(last));
+        }
+    }
+    if (fclose(fout) != 0) {
+        perror("fclose");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//Function to allocate empty columns
+void columns_init(column_set * cols) {
+    memset(cols, 0, sizeof(column_set));
+}
+
+void columns_free(column_set * cols) {
+    free(cols->zip);
+    free(cols->day);
+    free(cols->cases);
+    free(cols->tests);
+    free(cols->deaths);
+    free(cols->case_rate);
+    free(cols->test_rate);
+    free(cols->positive);
+    free(cols->death_rate);
+    free(cols->lon);
+    free(cols->lat);
+}
+
+//Function to grow a column to size entries
+void * column_grow(void * column, size_t size) {
+    column = realloc(column, size * 4);
+    if (column == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return column;
+}
+
+//Function to append one row's key, weekly rates and location to the columns
+void columns_append(column_set * cols, const record_key * key, field record[]) {
+    if (cols->rows == cols->size) {
+        cols->size = cols->size != 0 ? cols->size * 2 : 4096;
+        cols->zip = column_grow(cols->zip, cols->size);
+        cols->day = column_grow(cols->day, cols->size);
+        cols->cases = column_grow(cols->cases, cols->size);
+        cols->tests = column_grow(cols->tests, cols->size);
+        cols->deaths = column_grow(cols->deaths, cols->size);
+        cols->case_rate = column_grow(cols->case_rate, cols->size);
+        cols->test_rate = column_grow(cols->test_rate, cols->size);
+        cols->positive = column_grow(cols->positive, cols->size);
+        cols->death_rate = column_grow(cols->death_rate, cols->size);
+        cols->lon = column_grow(cols->lon, cols->size);
+        cols->lat = column_grow(cols->lat, cols->size);
+    }
+    size_t i = cols->rows++;
+    cols->zip[i] = key->zip;
+    cols->day[i] = key->day;
+    cols->cases[i] = key->cases;
+    cols->tests[i] = key->tests;
+    cols->deaths[i] = key->deaths;
+    cols->case_rate[i] = field_float(record[6]);
+    cols->test_rate[i] = field_float(record[10]);
+    cols->positive[i] = field_float(record[12]);
+    cols->death_rate[i] = field_float(record[16]);
+    if (field_point(record[20], &cols->lon[i], &cols->lat[i]) != 0) {
+        cols->lon[i] = NAN;
+        cols->lat[i] = NAN;
+    }
+}
+
+//Function to validate a tokenized row and pack its key, returns -1 for a rejected row
+//Accepted rows are also appended to cols when a cache sidecar is being built
+int parse_record(field record[], int count, record_key * key, column_set * cols) {
+    if (count != NO_OF_FIELDS || !field_is_number(record[0]) || !field_is_date(record[2])) {
+        return -1;
+    }
+    key->zip = field_int(record[0]);
+    key->day = get_day(record[2].ptr);
+    //The store packs the week start into 16 bits, 01/01/1970 to 06/06/2149
+    if (key->day < 0 || key->day > UINT16_MAX) {
+        return -1;
+    }
+    key->cases = field_int(record[4]);
+    key->tests = field_int(record[8]);
+    key->deaths = field_int(record[14]);
+    if (cols != NULL) {
+        columns_append(cols, key, record);
+    }
+    return 0;
+}
+
+//Function to count records and save unique records 
+int countRecord(field record[], int count, store * st, column_set * cols) {
+    record_key key;
+    st->stats.rows_read++;
+    if (parse_record(record, count, &key, cols) != 0) {
+        st->stats.rows_rejected++;
+        return -1;
+    }
+    place_note(&st->places, key.zip, record[20]);
+    st->stats.duplicates += store_row(st, &key) != 1;
+    return 0;
+}
+
+//Function to checksum a buffer 8 bytes at a time, the last partial word is zero padded
+uint64_t checksum64(const void * buf, size_t len) {
+    const unsigned char * p = buf;
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    uint64_t word;
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&word, p, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 29;
+    }
+    if (len != 0) {
+        word = 0;
+        memcpy(&word, p, len);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+//Function to checksum every byte of a data file as it is on disk (compressed for a .gz file)
+//Returns 0 with *hash unset if the file cannot be read
+int source_checksum(const char * path, uint64_t * hash) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        *hash = checksum64(NULL, 0);
+        return 1;
+    }
+    void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    *hash = checksum64(map, st.st_size);
+    munmap(map, st.st_size);
+    return 1;
+}
+
+//Function to build the sidecar path of a data file
+char * cache_path(const char * path) {
+    char * name = malloc(strlen(path) + sizeof(".cache"));
+    if (name == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(name, path);
+    strcat(name, ".cache");
+    return name;
+}
+
+//Function to load a data file from its sidecar into st
+//Returns the source size, or -1 if there is no valid sidecar and the text has to be parsed
+long cache_load(const char * path, store * st) {
+    struct stat src;
+    struct stat side;
+    cache_header header;
+    if (stat(path, &src) != 0) {
+        return -1;
+    }
+    char * name = cache_path(path);
+    int fd = open(name, O_RDONLY);
+    free(name);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &side) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+        || memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != CACHE_VERSION
+        || header.columns != CACHE_COLUMNS || header.source_size != (uint64_t)src.st_size
+        || header.source_mtime_sec != src.st_mtim.tv_sec || header.source_mtime_nsec != src.st_mtim.tv_nsec
+        || (uint64_t)side.st_size != sizeof(header) + header.rows * CACHE_COLUMNS * 4) {
+        close(fd);
+        return -1;
+    }
+    void * map = mmap(NULL, side.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    const int32_t * column = (const int32_t *)((const char *)map + sizeof(header));
+    size_t rows = header.rows;
+    uint64_t source;
+    if (!source_checksum(path, &source) || source != header.source_hash
+        || checksum64(column, rows * CACHE_COLUMNS * 4) != header.checksum) {
+        munmap(map, side.st_size);
+        return -1;
+    }
+    //Only the key and location columns are needed to rebuild the store
+    double start = collect_timings ? now_seconds() : 0;
+    size_t duplicates = 0;
+    const float * lon = (const float *)(column + 9 * rows);
+    const float * lat = (const float *)(column + 10 * rows);
+    for (size_t i = 0; i < rows; i++) {
+        record_key key = {column[i], column[rows + i], column[2 * rows + i], column[3 * rows + i], column[4 * rows + i]};
+        duplicates += store_row(st, &key) != 1;
+        if (!isnan(lon[i]) && !place_known(&st->places, key.zip)) {
+            place p = {key.zip, lon[i], lat[i]};
+            place_add(&st->places, &p);
+        }
+    }
+    //Only accepted rows are in a sidecar, so none are rejected
+    st->stats.rows_read += rows;
+    st->stats.duplicates += duplicates;
+    if (collect_timings) {
+        st->stats.dedup_seconds += now_seconds() - start;
+    }
+    munmap(map, side.st_size);
+    return src.st_size;
+}
+
+//Function to write the sidecar of a data file, via a temporary file renamed into place
+//A sidecar that cannot be written is skipped with a warning, the run itself is unaffected
+void cache_save(const char * path, const struct stat * src, uint64_t source, column_set * cols) {
+    cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.columns = CACHE_COLUMNS;
+    header.rows = cols->rows;
+    header.source_size = src->st_size;
+    header.source_mtime_sec = src->st_mtim.tv_sec;
+    header.source_mtime_nsec = src->st_mtim.tv_nsec;
+    header.source_hash = source;
+    const void * columns[CACHE_COLUMNS] = {cols->zip, cols->day, cols->cases, cols->tests, cols->deaths,
+                                           cols->case_rate, cols->test_rate, cols->positive, cols->death_rate,
+                                           cols->lon, cols->lat};
+    //The checksum runs over the columns as laid out in the file
+    size_t bytes = cols->rows * 4;
+    char * payload = malloc(bytes * CACHE_COLUMNS + 1);
+    if (payload == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int c = 0; c < CACHE_COLUMNS; c++) {
+        if (bytes != 0) {
+            memcpy(payload + c * bytes, columns[c], bytes);
+        }
+    }
+    header.checksum = checksum64(payload, bytes * CACHE_COLUMNS);
+
+    char * name = cache_path(path);
+    char * tmp = malloc(strlen(name) + 32);
+    if (tmp == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(tmp, "%s.%ld.tmp", name, (long)getpid());
+    FILE * fout = fopen(tmp, "wb");
+    if (fout == NULL || fwrite(&header, sizeof(header), 1, fout) != 1
+        || fwrite(payload, 1, bytes * CACHE_COLUMNS, fout) != bytes * CACHE_COLUMNS) {
+        fprintf(stderr, "warning: could not write cache %s\n", name);
+        if (fout != NULL) {
+            fclose(fout);
+            unlink(tmp);
+        }
+    }
+    else if (fclose(fout) != 0 || rename(tmp, name) != 0) {
+        fprintf(stderr, "warning: could not write cache %s\n", name);
+        unlink(tmp);
+    }
+    free(payload);
+    free(tmp);
+    free(name);
+}
+
+//Function to map a whole file read-only, returns NULL with *size 0 for an empty file
+//Exits on failure like the rest of the file handling
+const char * map_file(const char * path, size_t * size) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    *size = st.st_size;
+    if (*size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void * map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    madvise(map, *size, MADV_SEQUENTIAL);
+    return map;
+}
+
+//Gzip data files are inflated on a producer thread into GZ_SLOTS rotating buffers of about GZ_CHUNK bytes,
+//each cut after its last line break, which the parsing thread takes in order
+#define GZ_CHUNK (1 << 20)
+#define GZ_SLOTS 4
+
+//One buffer of the gzip chunk queue, holding len bytes of whole lines
+typedef struct gz_slot {
+  char * data;
+  size_t len;
+  size_t size;
+} gz_slot;
+
+//A data file being read chunk by chunk: one chunk covering the whole mmap of a plain file,
+//or the whole lines of a .gz file as the producer thread inflates them
+//Slots head .. head + count - 1 are full and belong to the reader, the rest belong to the producer
+typedef struct text_reader {
+  const char * map;
+  size_t size;
+  int gzip;
+  gzFile in;
+  pthread_t producer;
+  gz_slot slots[GZ_SLOTS];
+  int head;
+  int count;
+  int held;
+  int done;
+  int failed;
+  size_t bytes;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_cond_t freed;
+} text_reader;
+
+//Function to check whether a data file is gzip compressed, going by its name
+int is_gzip(const char * path) {
+    size_t len = strlen(path);
+    return len > 3 && strcmp(path + len - 3, ".gz") == 0;
+}
+
+//Producer thread: inflate the stream into free slots, carrying any partial last row over to the next slot
+//A slot is cut after its last line break outside double quotes, so a quoted field holding a line break
+//stays whole the way it does in a plain file; every slot therefore starts outside quotes
+void * gz_producer(void * arg) {
+    text_reader * r = arg;
+    char * carry = NULL;
+    size_t ncarry = 0;
+    int tail = 0;
+    for (;;) {
+        pthread_mutex_lock(&r->lock);
+        while (r->count == GZ_SLOTS) {
+            pthread_cond_wait(&r->freed, &r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+        gz_slot * slot = &r->slots[tail];
+        if (ncarry > 0) {
+            memcpy(slot->data, carry, ncarry);
+        }
+        size_t len = ncarry;
+        size_t scanned = 0;
+        int quoted = 0;
+        size_t cut = 0;
+        int eof = 0;
+        int failed = 0;
+        //Read until the slot holds an unquoted line break, growing it for a row longer than a chunk
+        for (;;) {
+            if (slot->size - len < GZ_CHUNK) {
+                slot->size = len + 2 * GZ_CHUNK;
+                slot->data = realloc(slot->data, slot->size);
+                if (slot->data == NULL) {
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            int n = gzread(r->in, slot->data + len, GZ_CHUNK);
+            if (n <= 0) {
+                //A truncated stream ends with a zero read and Z_BUF_ERROR rather than -1
+                int err;
+                gzerror(r->in, &err);
+                eof = 1;
+                failed = n < 0 || err != Z_OK;
+                break;
+            }
+            len += n;
+            //Quote parity carries on from the bytes already scanned, the carry included
+            for (; scanned < len; scanned++) {
+                if (slot->data[scanned] == '"') {
+                    quoted = !quoted;
+                }
+                else if (slot->data[scanned] == '\n' && !quoted) {
+                    cut = scanned + 1;
+                }
+            }
+            if (cut > 0) {
+                break;
+            }
+        }
+        if (eof) {
+            cut = len;
+        }
+        ncarry = len - cut;
+        if (ncarry > 0) {
+            carry = realloc(carry, ncarry);
+            if (carry == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(carry, slot->data + cut, ncarry);
+        }
+        slot->len = cut;
+        pthread_mutex_lock(&r->lock);
+        r->count++;
+        r->done = eof;
+        r->failed = failed;
+        pthread_cond_signal(&r->ready);
+        pthread_mutex_unlock(&r->lock);
+        tail = (tail + 1) % GZ_SLOTS;
+        if (eof) {
+            break;
+        }
+    }
+    free(carry);
+    return NULL;
+}
+
+//Function to open a data file for chunked reading, a .gz file starts its producer thread
+//Exits on failure like map_file
+void reader_open(text_reader * r, const char * path) {
+    memset(r, 0, sizeof(text_reader));
+    r->gzip = is_gzip(path);
+    if (!r->gzip) {
+        r->map = map_file(path, &r->size);
+        return;
+    }
+    r->in = gzopen(path, "rb");
+    if (r->in == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    gzbuffer(r->in, 1 << 17);
+    for (int i = 0; i < GZ_SLOTS; i++) {
+        r->slots[i].size = 2 * GZ_CHUNK;
+        r->slots[i].data = malloc(r->slots[i].size);
+        if (r->slots[i].data == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->ready, NULL);
+    pthread_cond_init(&r->freed, NULL);
+    if (pthread_create(&r->producer, NULL, gz_producer, r) != 0) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//Function to get the next chunk of whole lines as [*pos, *end), returns 0 once the file is exhausted
+//The previous chunk is handed back to the producer, so it must not be used after this call
+int reader_next(text_reader * r, const char ** pos, const char ** end) {
+    if (!r->gzip) {
+        if (r->held) {
+            return 0;
+        }
+        r->held = 1;
+        r->bytes = r->size;
+        *pos = r->map;
+        *end = r->map + r->size;
+        return 1;
+    }
+    pthread_mutex_lock(&r->lock);
+    if (r->held) {
+        r->head = (r->head + 1) % GZ_SLOTS;
+        r->count--;
+        r->held = 0;
+        pthread_cond_signal(&r->freed);
+    }
+    while (r->count == 0 && !r->done) {
+        pthread_cond_wait(&r->ready, &r->lock);
+    }
+    if (r->count == 0) {
+        pthread_mutex_unlock(&r->lock);
+        return 0;
+    }
+    gz_slot * slot = &r->slots[r->head];
+    r->held = 1;
+    //When the stream failed, its final queued slot (which may hold rows read before the error) is not
+    //consumed and the gzread error is reported instead
+    int failed = r->failed && r->count == 1;
+    pthread_mutex_unlock(&r->lock);
+    if (failed) {
+        int err;
+        fprintf(stderr, "gzread: %s\n", gzerror(r->in, &err));
+        exit(EXIT_FAILURE);
+    }
+    r->bytes += slot->len;
+    *pos = slot->data;
+    *end = slot->data + slot->len;
+    return 1;
+}
+
+//Function to finish reading a data file, every chunk must have been taken with reader_next
+void reader_close(text_reader * r) {
+    if (!r->gzip) {
+        if (r->map != NULL) {
+            munmap((void *)r->map, r->size);
+        }
+        return;
+    }
+    pthread_join(r->producer, NULL);
+    gzclose(r->in);
+    for (int i = 0; i < GZ_SLOTS; i++) {
+        free(r->slots[i].data);
+    }
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->ready);
+    pthread_cond_destroy(&r->freed);
+}
+
+//Function to ingest one data file through an mmap, fields are tokenized in place
+//Returns the number of bytes read
+//With use_cache set, a valid sidecar is loaded instead of the text and a new one is written after parsing
+//Opening, mapping and the sidecar are counted as io; pages of the text are faulted in (or inflated) while
+//tokenizing, so reading the text itself shows up as parse time
+//A .gz file is inflated on a second thread and parsed chunk by chunk, the count returned is of text bytes
+size_t ingest_file(const char * path, store * st, int use_cache) {
+    double start = collect_timings ? now_seconds() : 0;
+    if (use_cache) {
+        double dedup = st->stats.dedup_seconds;
+        long cached = cache_load(path, st);
+        if (cached >= 0) {
+            if (collect_timings) {
+                st->stats.io_seconds += now_seconds() - start - (st->stats.dedup_seconds - dedup);
+            }
+            return cached;
+        }
+    }
+    struct stat src;
+    if (stat(path, &src) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    //The source is hashed before it is parsed, so a rewrite during the parse leaves a sidecar that never matches
+    uint64_t source;
+    int hashed = use_cache && source_checksum(path, &source);
+    column_set cols;
+    columns_init(&cols);
+    text_reader reader;
+    reader_open(&reader, path);
+    const char * pos;
+    const char * end;
+    field record[NO_OF_FIELDS];
+    //Rows are parsed a batch at a time and then stored, so the two steps can be timed separately
+    record_key batch[INGEST_BATCH];
+    size_t rows = 0;
+    size_t accepted = 0;
+    size_t duplicates = 0;
+    if (collect_timings) {
+        st->stats.io_seconds += now_seconds() - start;
+    }
+    start = collect_timings ? now_seconds() : 0;
+    while (reader_next(&reader, &pos, &end)) {
+        while (pos < end) {
+            int n = 0;
+            int batch_rows = 0;
+            while (pos < end && n < INGEST_BATCH) {
+                int count = tokenize_row(pos, end, record, NO_OF_FIELDS, &pos);
+                if (parse_record(record, count, &batch[n], use_cache ? &cols : NULL) == 0) {
+                    place_note(&st->places, batch[n].zip, record[20]);
+                    n++;
+                }
+                batch_rows++;
+            }
+            double parsed = collect_timings ? now_seconds() : 0;
+            //Call function to start storing unique entries into struct
+            for (int i = 0; i < n; i++) {
+                duplicates += store_row(st, &batch[i]) != 1;
+            }
+            rows += batch_rows;
+            accepted += n;
+            if (collect_timings) {
+                double stored = now_seconds();
+                st->stats.parse_seconds += parsed - start;
+                st->stats.dedup_seconds += stored - parsed;
+                start = stored;
+            }
+        }
+    }
+    st->stats.rows_read += rows;
+    st->stats.rows_rejected += rows - accepted;
+    st->stats.duplicates += duplicates;
+    start = collect_timings ? now_seconds() : 0;
+    size_t size = reader.bytes;
+    reader_close(&reader);
+    if (hashed) {
+        cache_save(path, &src, source, &cols);
+    }
+    columns_free(&cols);
+    if (collect_timings) {
+        st->stats.io_seconds += now_seconds() - start;
+    }
+    return size;
+}
+
+//Names of the CSV columns as used by the group-by engine, in file order
+static const char * column_names[NO_OF_FIELDS] = {
+    "zip", "week_number", "week_start", "week_end",
+    "cases_weekly", "cases_cumulative", "case_rate_weekly", "case_rate_cumulative",
+    "tests_weekly", "tests_cumulative", "test_rate_weekly", "test_rate_cumulative",
+    "percent_positive_weekly", "percent_positive_cumulative",
+    "deaths_weekly", "deaths_cumulative", "death_rate_weekly", "death_rate_cumulative",
+    "population", "row_id", "location"
+};
+
+//Group-by keys and aggregate functions of the engine
+#define GROUP_ZIP 0
+#define GROUP_WEEK 1
+#define GROUP_MONTH 2
+#define GROUP_YEAR 3
+#define MAX_GROUP_COLUMNS 4
+static const char * group_names[MAX_GROUP_COLUMNS] = {"zip", "week", "month", "year"};
+
+#define AGG_SUM 0
+#define AGG_MIN 1
+#define AGG_MAX 2
+#define AGG_AVG 3
+#define AGG_COUNT 4
+#define MAX_AGGREGATES 32
+static const char * agg_names[] = {"sum", "min", "max", "avg", "count"};
+
+//One aggregate of a group-by query, column is -1 for a plain row count
+typedef struct agg_spec {
+  int op;
+  int column;
+} agg_spec;
+
+//A parsed group-by query; needed[] marks the numeric columns that have to be converted for it
+typedef struct groupby_plan {
+  int ngroups;
+  int groups[MAX_GROUP_COLUMNS];
+  int naggs;
+  agg_spec aggs[MAX_AGGREGATES];
+  unsigned char needed[NO_OF_FIELDS];
+} groupby_plan;
+
+//Running state of one aggregate in one group, count is the number of non-empty values folded in
+typedef struct agg_state {
+  double sum;
+  double min;
+  double max;
+  long long count;
+} agg_state;
+
+//Open-addressing table from group key to the first of the group's naggs agg_state entries
+//Keys and states live in chunked arrays, group i owns states i * naggs .. i * naggs + naggs - 1
+typedef struct groupby_table {
+  arena pool;
+  chunk_array keys;
+  chunk_array states;
+  uint32_t * slots;
+  size_t capacity;
+  int naggs;
+} groupby_table;
+
+//Group key of the engine, unused positions stay 0
+typedef struct groupby_key {
+  int v[MAX_GROUP_COLUMNS];
+} groupby_key;
+
+//Function to find a column by name, returns -1 if unknown
+int column_index(const char * name, size_t len) {
+    for (int c = 0; c < NO_OF_FIELDS; c++) {
+        if (strlen(column_names[c]) == len && strncmp(column_names[c], name, len) == 0) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+//Function to check a column holds numbers the engine can aggregate
+int column_is_numeric(int c) {
+    return c != 2 && c != 3 && c != 19 && c != 20;
+}
+
+//Function to parse "zip,month" style group columns and "sum:cases_weekly,avg:test_rate_weekly,count"
+//style aggregates into a plan; prints the problem and returns -1 if either list is malformed
+int groupby_parse(const char * groups, const char * aggs, groupby_plan * plan) {
+    memset(plan, 0, sizeof(groupby_plan));
+    for (const char * p = groups; *p != '\0';) {
+        size_t len = strcspn(p, ",");
+        int g = -1;
+        for (int i = 0; i < MAX_GROUP_COLUMNS; i++) {
+            if (strlen(group_names[i]) == len && strncmp(group_names[i], p, len) == 0) {
+                g = i;
+            }
+        }
+        if (g < 0 || plan->ngroups == MAX_GROUP_COLUMNS) {
+            fprintf(stderr, "unknown group column '%.*s' (use zip, week, month, year)\n", (int)len, p);
+            return -1;
+        }
+        plan->groups[plan->ngroups++] = g;
+        p += len + (p[len] == ',');
+    }
+    for (const char * p = aggs; *p != '\0';) {
+        size_t len = strcspn(p, ",");
+        size_t oplen = strcspn(p, ":,");
+        agg_spec spec = {-1, -1};
+        for (int i = 0; i < (int)(sizeof(agg_names) / sizeof(agg_names[0])); i++) {
+            if (strlen(agg_names[i]) == oplen && strncmp(agg_names[i], p, oplen) == 0) {
+                spec.op = i;
+            }
+        }
+        if (oplen < len) {
+            spec.column = column_index(p + oplen + 1, len - oplen - 1);
+        }
+        if (spec.op < 0 || plan->naggs == MAX_AGGREGATES || (spec.op != AGG_COUNT && spec.column < 0)
+            || (spec.column >= 0 && !column_is_numeric(spec.column))) {
+            fprintf(stderr, "bad aggregate '%.*s' (use sum|min|max|avg|count:column, or count)\n", (int)len, p);
+            return -1;
+        }
+        plan->aggs[plan->naggs++] = spec;
+        if (spec.column >= 0) {
+            plan->needed[spec.column] = 1;
+        }
+        p += len + (p[len] == ',');
+    }
+    if (plan->naggs == 0) {
+        plan->aggs[plan->naggs++] = (agg_spec){AGG_COUNT, -1};
+    }
+    return 0;
+}
+
+//Function to hash a group-by key
+uint64_t hash_groupby(const groupby_key * key) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < MAX_GROUP_COLUMNS; i++) {
+        h = (h ^ (uint32_t)key->v[i]) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+void groupby_init(groupby_table * table, int naggs) {
+    arena_init(&table->pool, 1 << 20);
+    chunks_init(&table->keys, sizeof(groupby_key), &table->pool);
+    chunks_init(&table->states, sizeof(agg_state), &table->pool);
+    table->capacity = 1024;
+    table->slots = calloc(table->capacity, sizeof(uint32_t));
+    if (table->slots == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    table->naggs = naggs;
+}
+
+void groupby_free(groupby_table * table) {
+    chunks_free(&table->keys);
+    chunks_free(&table->states);
+    free(table->slots);
+    arena_free(&table->pool);
+}
+
+//Function to find the slot holding key, or the empty slot where it belongs
+size_t groupby_probe(groupby_table * table, const groupby_key * key) {
+    size_t mask = table->capacity - 1;
+    size_t i = hash_groupby(key) & mask;
+    while (table->slots[i] != 0 && memcmp(chunk_at(&table->keys, table->slots[i] - 1), key, sizeof(groupby_key)) != 0) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+//Function to get the index of a group, creating it with empty aggregates if needed
+size_t groupby_lookup(groupby_table * table, const groupby_key * key) {
+    if ((table->keys.count + 1) * 4 > table->capacity * 3) {
+        uint32_t * old = table->slots;
+        size_t old_capacity = table->capacity;
+        table->capacity *= 2;
+        table->slots = calloc(table->capacity, sizeof(uint32_t));
+        if (table->slots == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i] != 0) {
+                table->slots[groupby_probe(table, chunk_at(&table->keys, old[i] - 1))] = old[i];
+            }
+        }
+        free(old);
+    }
+    size_t i = groupby_probe(table, key);
+    if (table->slots[i] == 0) {
+        *(groupby_key *)chunk_push(&table->keys) = *key;
+        for (int a = 0; a < table->naggs; a++) {
+            agg_state * state = chunk_push(&table->states);
+            state->sum = 0;
+            state->min = 0;
+            state->max = 0;
+            state->count = 0;
+        }
+        table->slots[i] = table->keys.count;
+    }
+    return table->slots[i] - 1;
+}
+
+//Function to fold one accepted row into its group
+//Only the columns the plan references are converted (projection pushdown), the rest stay raw slices
+void groupby_row(groupby_table * table, const groupby_plan * plan, field record[]) {
+    groupby_key key;
+    memset(&key, 0, sizeof(key));
+    for (int g = 0; g < plan->ngroups; g++) {
+        int which = plan->groups[g];
+        if (which == GROUP_ZIP) {
+            key.v[g] = field_int(record[0]);
+        }
+        else if (which == GROUP_WEEK) {
+            key.v[g] = field_int(record[1]);
+        }
+        else if (which == GROUP_MONTH) {
+            key.v[g] = get_month(record[2].ptr, 0);
+        }
+        else {
+            key.v[g] = get_year(record[2].ptr, 6);
+        }
+    }
+    double values[NO_OF_FIELDS];
+    for (int c = 0; c < NO_OF_FIELDS; c++) {
+        if (plan->needed[c]) {
+            values[c] = field_double(record[c]);
+        }
+    }
+    size_t group = groupby_lookup(table, &key);
+    for (int a = 0; a < plan->naggs; a++) {
+        agg_state * state = chunk_at(&table->states, group * table->naggs + a);
+        int c = plan->aggs[a].column;
+        //Empty fields are missing values, not zeros, for every aggregate over a column
+        if (c >= 0 && record[c].len == 0) {
+            continue;
+        }
+        double v = c >= 0 ? values[c] : 0;
+        if (state->count == 0 || v < state->min) {
+            state->min = v;
+        }
+        if (state->count == 0 || v > state->max) {
+            state->max = v;
+        }
+        state->sum += v;
+        state->count++;
+    }
+}
+
+//Function to scan data files in order into a group-by table
+//Rows are validated by parse_record and deduplicated like the main ingest, so sum:cases_weekly grouped by
+//zip,month,year matches the prompt answers
+void groupby_scan(char ** paths, int nfiles, const groupby_plan * plan, groupby_table * table) {
+    arena pool;
+    record_set seen;
+    arena_init(&pool, 4 << 20);
+    set_init(&seen, 1024, &pool);
+    field record[NO_OF_FIELDS];
+    for (int f = 0; f < nfiles; f++) {
+        text_reader reader;
+        const char * pos;
+        const char * end;
+        reader_open(&reader, paths[f]);
+        while (reader_next(&reader, &pos, &end)) {
+            while (pos < end) {
+                int count = tokenize_row(pos, end, record, NO_OF_FIELDS, &pos);
+                record_key key;
+                if (parse_record(record, count, &key, NULL) != 0) {
+                    continue;
+                }
+                if (set_insert(&seen, &key) == 1) {
+                    groupby_row(table, plan, record);
+                }
+            }
+        }
+        reader_close(&reader);
+    }
+    set_free(&seen);
+    arena_free(&pool);
+}
+
+//Sort context for groupby_write, qsort has no user pointer
+static groupby_table * sort_table;
+static int sort_ngroups;
+
+//Function to order group indexes by their key columns
+int compare_group(const void * a, const void * b) {
+    const groupby_key * x = chunk_at(&sort_table->keys, *(const size_t *)a);
+    const groupby_key * y = chunk_at(&sort_table->keys, *(const size_t *)b);
+    for (int g = 0; g < sort_ngroups; g++) {
+        if (x->v[g] != y->v[g]) {
+            return (x->v[g] > y->v[g]) - (x->v[g] < y->v[g]);
+        }
+    }
+    return 0;
+}
+
+//Function to write the groups as CSV sorted by key, with a header naming each column
+void groupby_write(groupby_table * table, const groupby_plan * plan, const char * path) {
+    FILE * fout = fopen(path, "w");
+    if (fout == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    for (int g = 0; g < plan->ngroups; g++) {
+        fprintf(fout, "%s,", group_names[plan->groups[g]]);
+    }
+    for (int a = 0; a < plan->naggs; a++) {
+        const agg_spec * spec = &plan->aggs[a];
+        fprintf(fout, "%s(%s)%s", agg_names[spec->op], spec->column >= 0 ? column_names[spec->column] : "*",
+                a + 1 < plan->naggs ? "," : "\n");
+    }
+    size_t ngroups = table->keys.count;
+    size_t * order = malloc((ngroups + 1) * sizeof(size_t));
+    if (order == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < ngroups; i++) {
+        order[i] = i;
+    }
+    sort_table = table;
+    sort_ngroups = plan->ngroups;
+    qsort(order, ngroups, sizeof(size_t), compare_group);
+    for (size_t i = 0; i < ngroups; i++) {
+        const groupby_key * key = chunk_at(&table->keys, order[i]);
+        for (int g = 0; g < plan->ngroups; g++) {
+            fprintf(fout, "%d,", key->v[g]);
+        }
+        for (int a = 0; a < plan->naggs; a++) {
+            const agg_state * state = chunk_at(&table->states, order[i] * table->naggs + a);
+            int op = plan->aggs[a].op;
+            double v = op == AGG_SUM ? state->sum : op == AGG_MIN ? state->min : op == AGG_MAX ? state->max
+                     : op == AGG_AVG ? (state->count != 0 ? state->sum / state->count : 0) : (double)state->count;
+            fprintf(fout, "%.15g%s", v, a + 1 < plan->naggs ? "," : "\n");
+        }
+    }
+    free(order);
+    fclose(fout);
+}
+
+//Shards to ingest and the index of the next one a worker should claim
+typedef struct ingest_job {
+  char ** paths;
+  store * shards;
+  int nshards;
+  int use_cache;
+  int next;
+} ingest_job;
+
+//Worker thread: claim shards one at a time and parse each into its own store
+void * ingest_worker(void * arg) {
+    ingest_job * job = arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->nshards) {
+            return NULL;
+        }
+        job->shards[i].bytes = ingest_file(job->paths[i], &job->shards[i], job->use_cache);
+    }
+}
+
+//Function to merge shard stores into st in shard order, so the result does not depend on thread timing
+//A record already seen in an earlier shard is subtracted from its shard's partial aggregate
+//before the partial aggregates are summed
+void merge_shards(store * shards, int nshards, store * st) {
+    for (int s = 0; s < nshards; s++) {
+        store * shard = &shards[s];
+        for (size_t i = 0; i < store_count(shard); i++) {
+            record_key key;
+            set_get(&shard->keys, i, &key);
+            if (store_insert(st, &key) != 1) {
+                st->stats.duplicates++;
+                data negated;
+                data_entry_struct(&key, &negated);
+                negated.cases = -negated.cases;
+                negated.tests = -negated.tests;
+                negated.deaths = -negated.deaths;
+                group_add(&shard->groups, &negated);
+            }
+        }
+        group_merge(&st->groups, &shard->groups);
+        place_merge(&st->places, &shard->places);
+        st->bytes += shard->bytes;
+        st->stats.rows_read += shard->stats.rows_read;
+        st->stats.rows_rejected += shard->stats.rows_rejected;
+        st->stats.duplicates += shard->stats.duplicates;
+        st->stats.io_seconds += shard->stats.io_seconds;
+        st->stats.parse_seconds += shard->stats.parse_seconds;
+        st->stats.dedup_seconds += shard->stats.dedup_seconds;
+    }
+}
+
+//Function to ingest every shard on up to nthreads worker threads and merge them into st
+//When sizes is not NULL it receives the number of bytes ingested from each shard
+void ingest_shards(char ** paths, int nshards, int nthreads, int use_cache, store * st, size_t * sizes) {
+    ingest_job job = {paths, malloc(nshards * sizeof(store)), nshards, use_cache, 0};
+    if (nthreads > nshards) {
+        nthreads = nshards;
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    pthread_t * threads = malloc(nthreads * sizeof(pthread_t));
+    if (job.shards == NULL || threads == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nshards; i++) {
+        store_init(&job.shards[i]);
+    }
+    for (int t = 0; t < nthreads; t++) {
+        if (pthread_create(&threads[t], NULL, ingest_worker, &job) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    phase_begin(&merge_phase);
+    merge_shards(job.shards, nshards, st);
+    phase_end(&merge_phase);
+    for (int i = 0; i < nshards; i++) {
+        if (sizes != NULL) {
+            sizes[i] = job.shards[i].bytes;
+        }
+        store_free(&job.shards[i]);
+    }
+    free(job.shards);
+    free(threads);
+}
+
+//Function to read exactly len bytes, returns -1 on a short read
+int read_exact(FILE * fin, void * buf, size_t len) {
+    return len == 0 || fread(buf, 1, len, fin) == len ? 0 : -1;
+}
+
+//Function to load a checkpoint into an empty store
+//Returns the file entries (paths in *names) and their count, or -1 if there is no usable checkpoint
+int checkpoint_load(const char * path, store * st, checkpoint_file ** files, char *** names) {
+    FILE * fin = fopen(path, "rb");
+    checkpoint_header header;
+    if (fin == NULL) {
+        return -1;
+    }
+    if (read_exact(fin, &header, sizeof(header)) != 0 || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0
+        || header.version != CHECKPOINT_VERSION || header.nkeys >= UINT32_MAX
+        || header.set_capacity == 0 || (header.set_capacity & (header.set_capacity - 1)) != 0
+        || header.group_capacity == 0 || (header.group_capacity & (header.group_capacity - 1)) != 0) {
+        fclose(fin);
+        return -1;
+    }
+    int nfiles = header.nfiles;
+    *files = calloc(nfiles + 1, sizeof(checkpoint_file));
+    *names = calloc(nfiles + 1, sizeof(char *));
+    if (*files == NULL || *names == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int ok = 1;
+    for (int f = 0; ok && f < nfiles; f++) {
+        ok = read_exact(fin, &(*files)[f], sizeof(checkpoint_file)) == 0 && (*files)[f].path_len < 65536;
+        if (ok) {
+            (*names)[f] = calloc((*files)[f].path_len + 1, 1);
+            ok = (*names)[f] != NULL && read_exact(fin, (*names)[f], (*files)[f].path_len) == 0;
+        }
+    }
+    //Keys go back into the record columns in their saved order, so the saved slots still point at them
+    record_key * block = malloc(CHUNK_ELEMS * sizeof(record_key));
+    for (uint64_t done = 0; ok && done < header.nkeys;) {
+        size_t n = header.nkeys - done < CHUNK_ELEMS ? header.nkeys - done : CHUNK_ELEMS;
+        ok = block != NULL && read_exact(fin, block, n * sizeof(record_key)) == 0;
+        for (size_t i = 0; ok && i < n; i++) {
+            ok = block[i].day >= 0 && block[i].day <= UINT16_MAX;
+            if (ok) {
+                set_append(&st->keys, &block[i]);
+            }
+        }
+        done += n;
+    }
+    free(block);
+    if (ok) {
+        free(st->keys.slots);
+        st->keys.capacity = header.set_capacity;
+        st->keys.slots = malloc(header.set_capacity * sizeof(uint32_t));
+        group_free(&st->groups);
+        group_init(&st->groups, header.group_capacity);
+        st->groups.count = header.group_count;
+        ok = st->keys.slots != NULL && read_exact(fin, st->keys.slots, header.set_capacity * sizeof(uint32_t)) == 0
+             && read_exact(fin, st->groups.slots, header.group_capacity * sizeof(data)) == 0
+             && read_exact(fin, st->groups.used, header.group_capacity) == 0;
+    }
+    for (uint64_t i = 0; ok && i < header.nplaces; i++) {
+        place p;
+        ok = read_exact(fin, &p, sizeof(place)) == 0 && p.zip != -1;
+        if (ok) {
+            place_add(&st->places, &p);
+        }
+    }
+    fclose(fin);
+    if (!ok) {
+        for (int f = 0; f < nfiles; f++) {
+            free((*names)[f]);
+        }
+        free(*files);
+        free(*names);
+        store_free(st);
+        store_init(st);
+        return -1;
+    }
+    return nfiles;
+}
+
+//Function to write the store and per-file progress to a checkpoint, via a temporary file renamed into place
+void checkpoint_save(const char * path, store * st, char ** paths, checkpoint_file * files, int nfiles) {
+    checkpoint_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.nfiles = nfiles;
+    header.nkeys = store_count(st);
+    header.set_capacity = st->keys.capacity;
+    header.group_capacity = st->groups.capacity;
+    header.group_count = st->groups.count;
+    header.nplaces = st->places.count;
+    char * tmp = malloc(strlen(path) + 32);
+    if (tmp == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(tmp, "%s.%ld.tmp", path, (long)getpid());
+    FILE * fout = fopen(tmp, "wb");
+    int ok = fout != NULL && fwrite(&header, sizeof(header), 1, fout) == 1;
+    for (int f = 0; ok && f < nfiles; f++) {
+        files[f].path_len = strlen(paths[f]);
+        ok = fwrite(&files[f], sizeof(checkpoint_file), 1, fout) == 1
+             && fwrite(paths[f], 1, files[f].path_len, fout) == files[f].path_len;
+    }
+    //Records are written back out as packed keys, a chunk at a time
+    record_key * block = malloc(CHUNK_ELEMS * sizeof(record_key));
+    ok = ok && block != NULL;
+    for (size_t c = 0; ok && c < st->keys.records.nchunks; c++) {
+        size_t n = header.nkeys - c * CHUNK_ELEMS < CHUNK_ELEMS ? header.nkeys - c * CHUNK_ELEMS : CHUNK_ELEMS;
+        for (size_t i = 0; i < n; i++) {
+            set_get(&st->keys, c * CHUNK_ELEMS + i, &block[i]);
+        }
+        ok = fwrite(block, sizeof(record_key), n, fout) == n;
+    }
+    free(block);
+    ok = ok && fwrite(st->keys.slots, sizeof(uint32_t), st->keys.capacity, fout) == st->keys.capacity
+         && fwrite(st->groups.slots, sizeof(data), st->groups.capacity, fout) == st->groups.capacity
+         && fwrite(st->groups.used, 1, st->groups.capacity, fout) == st->groups.capacity;
+    for (size_t i = 0; ok && i < st->places.capacity; i++) {
+        if (st->places.slots[i].zip != -1) {
+            ok = fwrite(&st->places.slots[i], sizeof(place), 1, fout) == 1;
+        }
+    }
+    if (fout != NULL && fclose(fout) != 0) {
+        ok = 0;
+    }
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "warning: could not write checkpoint %s\n", path);
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+//Function to hash the window of bytes that ends at offset, as checked when a file is resumed there
+static inline uint64_t checkpoint_window(const char * map, size_t offset) {
+    size_t len = offset < CHECKPOINT_WINDOW ? offset : CHECKPOINT_WINDOW;
+    return checksum64(map + offset - len, len);
+}
+
+//Function to record how far a file was ingested: up to the end of its last complete line, so a final row
+//without a line break is parsed again (and dropped as a duplicate) next time rather than forcing a rebuild
+void checkpoint_mark(const char * map, size_t size, checkpoint_file * progress) {
+    const char * last = size > 0 ? memrchr(map, '\n', size) : NULL;
+    progress->offset = last != NULL ? (size_t)(last - map) + 1 : 0;
+    progress->window_hash = checkpoint_window(map, progress->offset);
+}
+
+//Function to parse the rows of path from byte offset onwards straight into st
+//The bytes before offset must end on a line break and their last CHECKPOINT_WINDOW must still hash to
+//window_hash, otherwise the file was rewritten rather than appended to and -1 is returned; only that window
+//is re-read, so a refresh costs the new bytes rather than the whole history. On success *progress covers
+//every complete line. Mapping and the window hash count as io, then rows are parsed and stored in batches
+//as in ingest_file
+int ingest_tail(const char * path, const checkpoint_file * from, store * st, checkpoint_file * progress) {
+    //Compressed files cannot be resumed at a text offset, so they are always rebuilt
+    if (is_gzip(path)) {
+        return -1;
+    }
+    double start = collect_timings ? now_seconds() : 0;
+    size_t size;
+    const char * map = map_file(path, &size);
+    if (size < from->offset || (from->offset > 0 && map[from->offset - 1] != '\n')
+        || checkpoint_window(map, from->offset) != from->window_hash) {
+        if (map != NULL) {
+            munmap((void *)map, size);
+        }
+        if (collect_timings) {
+            st->stats.io_seconds += now_seconds() - start;
+        }
+        return -1;
+    }
+    const char * pos = map + from->offset;
+    const char * end = map + size;
+    field record[NO_OF_FIELDS];
+    record_key batch[INGEST_BATCH];
+    if (collect_timings) {
+        double now = now_seconds();
+        st->stats.io_seconds += now - start;
+        start = now;
+    }
+    while (pos < end) {
+        int n = 0;
+        int batch_rows = 0;
+        while (pos < end && n < INGEST_BATCH) {
+            int count = tokenize_row(pos, end, record, NO_OF_FIELDS, &pos);
+            if (parse_record(record, count, &batch[n], NULL) == 0) {
+                place_note(&st->places, batch[n].zip, record[20]);
+                n++;
+            }
+            batch_rows++;
+        }
+        double parsed = collect_timings ? now_seconds() : 0;
+        for (int i = 0; i < n; i++) {
+            st->stats.duplicates += store_row(st, &batch[i]) != 1;
+        }
+        st->stats.rows_read += batch_rows;
+        st->stats.rows_rejected += batch_rows - n;
+        if (collect_timings) {
+            double stored = now_seconds();
+            st->stats.parse_seconds += parsed - start;
+            st->stats.dedup_seconds += stored - parsed;
+            start = stored;
+        }
+    }
+    checkpoint_mark(map, size, progress);
+    st->bytes += size - from->offset;
+    if (map != NULL) {
+        munmap((void *)map, size);
+    }
+    if (collect_timings) {
+        st->stats.io_seconds += now_seconds() - start;
+    }
+    return 0;
+}
+
+//Function to ingest through a checkpoint: files already in it are only parsed past their recorded offset
+//Any file that was rewritten, or a checkpoint file missing from this run, forces a full parallel rebuild
+void ingest_incremental(const char * checkpoint, char ** paths, int nshards, int nthreads, int use_cache, store * st) {
+    checkpoint_file * old = NULL;
+    char ** names = NULL;
+    checkpoint_file * progress = calloc(nshards, sizeof(checkpoint_file));
+    if (progress == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int nold = checkpoint_load(checkpoint, st, &old, &names);
+    int ok = nold >= 0;
+    //Every file the checkpoint has seen must still be part of the input
+    for (int f = 0; ok && f < nold; f++) {
+        int found = 0;
+        for (int i = 0; i < nshards; i++) {
+            found |= strcmp(names[f], paths[i]) == 0;
+        }
+        ok = found;
+    }
+    for (int i = 0; ok && i < nshards; i++) {
+        checkpoint_file start = {0, checkpoint_window(NULL, 0), 0};
+        for (int f = 0; f < nold; f++) {
+            if (strcmp(names[f], paths[i]) == 0) {
+                start = old[f];
+            }
+        }
+        ok = ingest_tail(paths[i], &start, st, &progress[i]) == 0;
+        if (!ok) {
+            fprintf(stderr, is_gzip(paths[i]) ? "%s is compressed and cannot be resumed, rebuilding\n"
+                    : "%s changed before its checkpoint offset, rebuilding\n", paths[i]);
+        }
+    }
+    if (!ok) {
+        //Start over from the text (or cache sidecars) and checkpoint the files as ingested
+        size_t * sizes = malloc(nshards * sizeof(size_t));
+        if (sizes == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        store_free(st);
+        store_init(st);
+        ingest_shards(paths, nshards, nthreads, use_cache, st, sizes);
+        //Compressed files are never resumed, so their progress is left empty
+        for (int i = 0; i < nshards; i++) {
+            if (is_gzip(paths[i])) {
+                progress[i] = (checkpoint_file){0, checkpoint_window(NULL, 0), 0};
+                continue;
+            }
+            size_t size;
+            const char * map = map_file(paths[i], &size);
+            checkpoint_mark(map, sizes[i] < size ? sizes[i] : size, &progress[i]);
+            if (map != NULL) {
+                munmap((void *)map, size);
+            }
+        }
+        free(sizes);
+    }
+    checkpoint_save(checkpoint, st, paths, progress, nshards);
+    for (int f = 0; f < nold; f++) {
+        free(names[f]);
+    }
+    free(names);
+    free(old);
+    free(progress);
+}
+
+//Memory one deduplicated record takes while its partition is loaded and indexed, with headroom
+#define SPILL_RECORD_BYTES 128
+
+//Fewest bytes a CSV row takes, used to size the partitions before the rows have been counted
+#define SPILL_ROW_BYTES 64
+
+//Most spill files kept open at once
+#define MAX_SPILL_PARTS 1000
+
+//Function to parse a memory size such as 512M or 2G, returns 0 if malformed
+size_t parse_size(const char * text) {
+    char * end;
+    double value = strtod(text, &end);
+    double scale = 1;
+    if (*end == 'K' || *end == 'k') {
+        scale = 1 << 10;
+    }
+    else if (*end == 'M' || *end == 'm') {
+        scale = 1 << 20;
+    }
+    else if (*end == 'G' || *end == 'g') {
+        scale = 1 << 30;
+    }
+    else if (*end != '\0') {
+        return 0;
+    }
+    if (end == text || (*end != '\0' && end[1] != '\0') || !(value > 0)) {
+        return 0;
+    }
+    return (size_t)(value * scale);
+}
+
+//Function to pick the spill partition of a zip, so every record (and duplicate) of a zip lands in the same one
+static inline int spill_part(int zip, int nparts) {
+    return hash_group(zip, 0, 0) % nparts;
+}
+
+//Function to check whether a prompt sums over zips, so its answer is the sum of its answers per partition
+static inline int query_additive(const query * q) {
+    return q->kind == QUERY_RANGE || q->kind == QUERY_BOX || q->kind == QUERY_RADIUS || q->kind == QUERY_DISTINCT;
+}
+
+//Function to check whether a prompt is answered partition by partition in out-of-core mode; a heavy hitter
+//ranking keeps the best k of every partition's own best k
+static inline int query_partitioned(const query * q) {
+    return query_additive(q) || q->kind == QUERY_HEAVY;
+}
+
+//Function to fold the heavy hitter ranking of one partition into the ranking of the partitions before it
+void heavy_merge(query * q, const query * share) {
+    int cap = q->nranked + share->nranked < q->k ? q->nranked + share->nranked : q->k;
+    rank_entry * heap = malloc((cap > 0 ? cap : 1) * sizeof(rank_entry));
+    if (heap == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int n = 0;
+    for (int i = 0; i < q->nranked; i++) {
+        rank_push(heap, &n, cap, &q->ranked[i], 1);
+    }
+    for (int i = 0; i < share->nranked; i++) {
+        rank_push(heap, &n, cap, &share->ranked[i], 1);
+    }
+    rank_finish(heap, n, 1);
+    free(q->ranked);
+    q->ranked = heap;
+    q->nranked = n;
+}
+
+//Function to split every row of the data files into per-partition spill files of packed record keys
+//Zip locations and row counters go straight into st, nothing else is kept in memory
+void spill_rows(char ** paths, int nshards, FILE ** parts, int nparts, store * st) {
+    field record[NO_OF_FIELDS];
+    for (int f = 0; f < nshards; f++) {
+        double start = collect_timings ? now_seconds() : 0;
+        text_reader reader;
+        const char * pos;
+        const char * end;
+        reader_open(&reader, paths[f]);
+        while (reader_next(&reader, &pos, &end)) {
+            while (pos < end) {
+                int count = tokenize_row(pos, end, record, NO_OF_FIELDS, &pos);
+                record_key key;
+                st->stats.rows_read++;
+                if (parse_record(record, count, &key, NULL) != 0) {
+                    st->stats.rows_rejected++;
+                    continue;
+                }
+                place_note(&st->places, key.zip, record[20]);
+                if (fwrite(&key, sizeof(record_key), 1, parts[spill_part(key.zip, nparts)]) != 1) {
+                    perror("spill");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        st->bytes += reader.bytes;
+        reader_close(&reader);
+        if (collect_timings) {
+            st->stats.parse_seconds += now_seconds() - start;
+        }
+    }
+}
+
+//Function to ingest data files larger than memory: rows are hash-partitioned by zip into spill files,
+//then each partition is deduplicated and aggregated on its own within budget bytes
+//The (zip, month, year) groups of every partition end up in st; range, box, radius and distinct prompts are
+//answered partition by partition and summed, and heavy hitter rankings merged, which is exact because
+//a zip lives in one partition only
+void ingest_spilled(char ** paths, int nshards, size_t budget, query * prompts, int nprompts, store * st) {
+    //Size the partitions from the input size, assuming the shortest plausible rows
+    size_t input = 0;
+    for (int f = 0; f < nshards; f++) {
+        struct stat src;
+        if (stat(paths[f], &src) != 0) {
+            fprintf(stderr, "%s: %s\n", paths[f], strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        input += src.st_size;
+    }
+    double need = (double)input / SPILL_ROW_BYTES * SPILL_RECORD_BYTES;
+    int nparts = need > budget ? (int)(need / budget) + 1 : 1;
+    if (nparts > MAX_SPILL_PARTS) {
+        fprintf(stderr, "warning: %d partitions needed for this budget, using %d\n", nparts, MAX_SPILL_PARTS);
+        nparts = MAX_SPILL_PARTS;
+    }
+    //Write buffers share a quarter of the budget
+    size_t buffer = budget / 4 / nparts;
+    buffer = buffer < 4096 ? 4096 : buffer > (1 << 20) ? (1 << 20) : buffer;
+
+    const char * tmpdir = getenv("TMPDIR");
+    char * dir = malloc(strlen(tmpdir != NULL ? tmpdir : "/tmp") + 32);
+    if (dir == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(dir, "%s/covid-spill-XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    char * name = malloc(strlen(dir) + 32);
+    FILE ** parts = malloc(nparts * sizeof(FILE *));
+    if (name == NULL || parts == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int p = 0; p < nparts; p++) {
+        sprintf(name, "%s/part_%d.bin", dir, p);
+        parts[p] = fopen(name, "w+b");
+        if (parts[p] == NULL) {
+            perror(name);
+            exit(EXIT_FAILURE);
+        }
+        //The file stays reachable through the stream only, so nothing is left behind on exit
+        unlink(name);
+        setvbuf(parts[p], NULL, _IOFBF, buffer);
+    }
+    rmdir(dir);
+    spill_rows(paths, nshards, parts, nparts, st);
+
+    //One partition at a time: dedup and aggregate it, answer its share of the additive prompts, keep its groups
+    record_key * block = malloc(CHUNK_ELEMS * sizeof(record_key));
+    if (block == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int additive = 0;
+    for (int m = 0; m < nprompts; m++) {
+        additive += query_partitioned(&prompts[m]);
+    }
+    int oversized = 0;
+    for (int p = 0; p < nparts; p++) {
+        if (fflush(parts[p]) != 0 || fseek(parts[p], 0, SEEK_SET) != 0) {
+            perror("spill");
+            exit(EXIT_FAILURE);
+        }
+        store part;
+        store_init(&part);
+        double start = collect_timings ? now_seconds() : 0;
+        size_t n;
+        while ((n = fread(block, sizeof(record_key), CHUNK_ELEMS, parts[p])) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                st->stats.duplicates += store_row(&part, &block[i]) != 1;
+            }
+        }
+        if (ferror(parts[p])) {
+            perror("spill");
+            exit(EXIT_FAILURE);
+        }
+        fclose(parts[p]);
+        if (collect_timings) {
+            st->stats.dedup_seconds += now_seconds() - start;
+        }
+        if (!oversized && store_count(&part) * SPILL_RECORD_BYTES > budget) {
+            fprintf(stderr, "warning: partition %d holds %zu records, more than the memory budget allows\n",
+                    p, store_count(&part));
+            oversized = 1;
+        }
+        if (additive > 0) {
+            //The partition's own zips, so a box or radius counts each matched zip once overall
+            for (size_t i = 0; i < st->places.capacity; i++) {
+                if (st->places.slots[i].zip != -1 && spill_part(st->places.slots[i].zip, nparts) == p) {
+                    place_add(&part.places, &st->places.slots[i]);
+                }
+            }
+            series_index series;
+            series_build(&part, &series);
+            for (int m = 0; m < nprompts; m++) {
+                if (prompts[m].kind == QUERY_HEAVY) {
+                    query share = prompts[m];
+                    answer_query(&share, &part, &series);
+                    heavy_merge(&prompts[m], &share);
+                    query_free(&share);
+                }
+                else if (query_additive(&prompts[m])) {
+                    query share = prompts[m];
+                    answer_query(&share, &part, &series);
+                    prompts[m].cases += share.cases;
+                    prompts[m].tests += share.tests;
+                    prompts[m].deaths += share.deaths;
+                    prompts[m].matched += share.matched;
+                }
+            }
+            series_free(&series);
+        }
+        group_merge(&st->groups, &part.groups);
+        st->stats.spilled += store_count(&part);
+        store_free(&part);
+    }
+    free(block);
+    free(parts);
+    free(name);
+    free(dir);
+}
+
+//Approximate mode keeps fixed-size sketches of the row stream instead of the record store:
+//a Bloom filter drops repeated rows, a Count-Min sketch sums cases, tests and deaths per (zip, month, year),
+//HyperLogLog counts distinct zips overall and per week start, and Space-Saving tracks the heaviest zips per metric
+//Bits of the Bloom filter (4 MB), the hashes set per row follow from the error bound
+#define BLOOM_BITS ((size_t)1 << 25)
+
+//Rows of the Count-Min sketch, failure probability e^-5 (under 1%) for each estimate
+#define SKETCH_DEPTH 5
+
+//Bytes the Count-Min sketch may use, so it is wider than e / error when that fits; a wider sketch
+//mixes fewer (zip, month, year) groups into each cell
+#define SKETCH_COUNT_BYTES (2 << 20)
+
+//Zips each Space-Saving summary monitors at least; with fewer distinct zips the heavy counts are exact
+#define HEAVY_MIN_CAPACITY 4096
+
+//Week starts with their own HyperLogLog, later weeks only count towards the overall estimate
+#define MAX_SKETCH_WEEKS 1024
+
+//Most HyperLogLog precision bits: 2^16 one-byte registers (64 KB) for the overall distinct count, a standard
+//error of 0.4%, and 2^12 (4 KB) for each week start so MAX_SKETCH_WEEKS of them stay within 4 MB
+#define MAX_HLL_PRECISION 16
+#define MAX_WEEK_PRECISION 12
+
+//Tightest error bound accepted for -X, which keeps the sketches within a few MB
+#define MIN_SKETCH_ERROR 0.0001
+
+//One monitored zip of a Space-Saving summary; count overestimates the zip's total by at most error
+typedef struct heavy_entry {
+  int zip;
+  long long count;
+  long long error;
+} heavy_entry;
+
+//Space-Saving summary of at most capacity zips, a min-heap on count so the smallest can be evicted
+//slots is an open addressing index from zip to heap position (zip -1 = empty), twice the capacity
+typedef struct heavy_table {
+  int capacity;
+  int count;
+  heavy_entry * heap;
+  int * slot_zip;
+  int * slot_pos;
+  int nslots;
+} heavy_table;
+
+//HyperLogLog registers of 2^precision buckets
+typedef struct hll {
+  int precision;
+  unsigned char * registers;
+} hll;
+
+//Every sketch of an approximate run; counts holds SKETCH_DEPTH rows of width cells, each with
+//the three metrics, and totals the metric sums of the stream's positive values; negatives and
+//negative_totals do the same for the magnitudes of negative values, allocated on the first one
+//week_precision is that of each week's HyperLogLog, week_warned is set once a week's distinct count
+//was answered with a standard error above the bound; week_days maps a week start to its
+//HyperLogLog in weeks (a slot is empty while its registers are NULL, since day 0 is a real week start)
+//bloom_set counts the set filter bits, bloom_capacity is the rows it takes before its false positive rate
+//passes error / 2, and bloom_dropped the expected number of unique rows it wrongly dropped
+typedef struct sketch_set {
+  double error;
+  unsigned char * bloom;
+  int bloom_hashes;
+  size_t bloom_set;
+  size_t bloom_capacity;
+  double bloom_dropped;
+  int width;
+  long long * counts;
+  long long totals[3];
+  long long * negatives;
+  long long negative_totals[3];
+  hll zips;
+  int week_precision;
+  int week_warned;
+  int * week_days;
+  hll * weeks;
+  int weeks_dropped;
+  heavy_table heavy[METRIC_POSITIVITY];
+  size_t bytes;
+} sketch_set;
+
+//Function to mix a 64 bit value into a well spread hash (splitmix64 finalizer)
+static inline uint64_t sketch_hash(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+//Function to allocate zeroed sketch memory and count it towards the sketch footprint
+void * sketch_alloc(sketch_set * sk, size_t size) {
+    void * p = calloc(1, size);
+    if (p == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    sk->bytes += size;
+    return p;
+}
+
+//Function to start an empty HyperLogLog
+void hll_init(sketch_set * sk, hll * h, int precision) {
+    h->precision = precision;
+    h->registers = sketch_alloc(sk, (size_t)1 << precision);
+}
+
+//Function to add a hashed item to a HyperLogLog: the top bits pick the register, the rest give the rank
+static inline void hll_add(hll * h, uint64_t hash) {
+    size_t r = hash >> (64 - h->precision);
+    uint64_t rest = hash << h->precision | (uint64_t)1 << (h->precision - 1);
+    unsigned char rank = __builtin_clzll(rest) + 1;
+    if (rank > h->registers[r]) {
+        h->registers[r] = rank;
+    }
+}
+
+//Function to estimate the distinct count of a HyperLogLog, with linear counting for small counts
+double hll_estimate(const hll * h) {
+    int m = 1 << h->precision;
+    double sum = 0;
+    int zeros = 0;
+    for (int r = 0; r < m; r++) {
+        sum += ldexp(1.0, -h->registers[r]);
+        zeros += h->registers[r] == 0;
+    }
+    double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 : 0.7213 / (1 + 1.079 / m);
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log((double)m / zeros);
+    }
+    return estimate;
+}
+
+//Function to start an empty Space-Saving summary of capacity zips
+void heavy_init(sketch_set * sk, heavy_table * t, int capacity) {
+    t->capacity = capacity;
+    t->count = 0;
+    t->heap = sketch_alloc(sk, capacity * sizeof(heavy_entry));
+    t->nslots = 1;
+    while (t->nslots < 2 * capacity) {
+        t->nslots <<= 1;
+    }
+    t->slot_zip = sketch_alloc(sk, t->nslots * sizeof(int));
+    t->slot_pos = sketch_alloc(sk, t->nslots * sizeof(int));
+    memset(t->slot_zip, 0xff, t->nslots * sizeof(int));
+}
+
+//Function to find the index slot of zip, or the empty slot where it would go
+static inline int heavy_slot(const heavy_table * t, int zip) {
+    int i = hash_group(zip, 0, 0) & (t->nslots - 1);
+    while (t->slot_zip[i] != -1 && t->slot_zip[i] != zip) {
+        i = (i + 1) & (t->nslots - 1);
+    }
+    return i;
+}
+
+//Function to remove zip from the index, shifting later entries of its probe run back into the gap
+void heavy_unindex(heavy_table * t, int zip) {
+    int mask = t->nslots - 1;
+    int hole = heavy_slot(t, zip);
+    t->slot_zip[hole] = -1;
+    for (int i = (hole + 1) & mask; t->slot_zip[i] != -1; i = (i + 1) & mask) {
+        int home = hash_group(t->slot_zip[i], 0, 0) & mask;
+        //Move the entry back unless its home lies cyclically in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            t->slot_zip[hole] = t->slot_zip[i];
+            t->slot_pos[hole] = t->slot_pos[i];
+            t->slot_zip[i] = -1;
+            hole = i;
+        }
+    }
+}
+
+//Function to swap two heap positions and keep the index pointing at them
+static inline void heavy_swap(heavy_table * t, int a, int b) {
+    heavy_entry e = t->heap[a];
+    t->heap[a] = t->heap[b];
+    t->heap[b] = e;
+    t->slot_pos[heavy_slot(t, t->heap[a].zip)] = a;
+    t->slot_pos[heavy_slot(t, t->heap[b].zip)] = b;
+}
+
+//Function to restore the min-heap below position i after its count grew
+void heavy_sift_down(heavy_table * t, int i) {
+    for (;;) {
+        int least = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        if (l < t->count && t->heap[l].count < t->heap[least].count) {
+            least = l;
+        }
+        if (r < t->count && t->heap[r].count < t->heap[least].count) {
+            least = r;
+        }
+        if (least == i) {
+            return;
+        }
+        heavy_swap(t, i, least);
+        i = least;
+    }
+}
+
+//Function to add weight to zip: a monitored zip grows, a new one takes a free entry or replaces the smallest,
+//inheriting its count as the error
+void heavy_add(heavy_table * t, int zip, long long weight) {
+    int s = heavy_slot(t, zip);
+    if (t->slot_zip[s] == zip) {
+        t->heap[t->slot_pos[s]].count += weight;
+        heavy_sift_down(t, t->slot_pos[s]);
+        return;
+    }
+    if (t->count < t->capacity) {
+        int c = t->count++;
+        t->heap[c] = (heavy_entry){zip, weight, 0};
+        t->slot_zip[s] = zip;
+        t->slot_pos[s] = c;
+        while (c > 0 && t->heap[(c - 1) / 2].count > t->heap[c].count) {
+            heavy_swap(t, c, (c - 1) / 2);
+            c = (c - 1) / 2;
+        }
+        return;
+    }
+    long long floor = t->heap[0].count;
+    heavy_unindex(t, t->heap[0].zip);
+    s = heavy_slot(t, zip);
+    t->heap[0] = (heavy_entry){zip, floor + weight, floor};
+    t->slot_zip[s] = zip;
+    t->slot_pos[s] = 0;
+    heavy_sift_down(t, 0);
+}
+
+//Function to size every sketch for the relative error bound: Count-Min width e / error (or what
+//SKETCH_COUNT_BYTES allows, if wider), HyperLogLog precision for a standard error of 1.04 / sqrt(2^p) <= error
+//(4..MAX_HLL_PRECISION bits, at most MAX_WEEK_PRECISION per week start), Space-Saving capacity 1 / error
+//(at least HEAVY_MIN_CAPACITY), and -log2(error / 2) Bloom hashes
+//None of them grows with the input
+void sketch_init(sketch_set * sk, double error) {
+    memset(sk, 0, sizeof(sketch_set));
+    sk->error = error;
+    sk->bloom = sketch_alloc(sk, BLOOM_BITS / 8);
+    sk->bloom_hashes = (int)ceil(-log2(error / 2));
+    //The false positive rate is the filled fraction to the power of the hashes, each row fills about k bits
+    double fill = pow(error / 2, 1.0 / sk->bloom_hashes);
+    sk->bloom_capacity = (size_t)(-log1p(-fill) * BLOOM_BITS / sk->bloom_hashes);
+    sk->width = (int)ceil(M_E / error);
+    if (sk->width < SKETCH_COUNT_BYTES / (SKETCH_DEPTH * 3 * (int)sizeof(long long))) {
+        sk->width = SKETCH_COUNT_BYTES / (SKETCH_DEPTH * 3 * (int)sizeof(long long));
+    }
+    sk->counts = sketch_alloc(sk, (size_t)SKETCH_DEPTH * sk->width * 3 * sizeof(long long));
+    int precision = (int)ceil(log2(1.04 * 1.04 / (error * error)));
+    precision = precision < 4 ? 4 : precision > MAX_HLL_PRECISION ? MAX_HLL_PRECISION : precision;
+    hll_init(sk, &sk->zips, precision);
+    sk->week_precision = precision < MAX_WEEK_PRECISION ? precision : MAX_WEEK_PRECISION;
+    sk->week_days = sketch_alloc(sk, MAX_SKETCH_WEEKS * sizeof(int));
+    sk->weeks = sketch_alloc(sk, MAX_SKETCH_WEEKS * sizeof(hll));
+    for (int m = 0; m < METRIC_POSITIVITY; m++) {
+        int capacity = (int)ceil(1 / error);
+        heavy_init(sk, &sk->heavy[m], capacity > HEAVY_MIN_CAPACITY ? capacity : HEAVY_MIN_CAPACITY);
+    }
+}
+
+//Function to release every sketch
+void sketch_free(sketch_set * sk) {
+    free(sk->bloom);
+    free(sk->counts);
+    free(sk->negatives);
+    free(sk->zips.registers);
+    for (int w = 0; w < MAX_SKETCH_WEEKS; w++) {
+        free(sk->weeks[w].registers);
+    }
+    free(sk->weeks);
+    free(sk->week_days);
+    for (int m = 0; m < METRIC_POSITIVITY; m++) {
+        free(sk->heavy[m].heap);
+        free(sk->heavy[m].slot_zip);
+        free(sk->heavy[m].slot_pos);
+    }
+}
+
+//Function to test and set the Bloom filter bits of a row, returns 1 if they were all set already
+//A false positive drops a unique row; its chance, the filled fraction to the power of the hashes, is added up
+//for every new row so the undercount can be reported
+int sketch_seen(sketch_set * sk, const record_key * key) {
+    uint64_t h1 = sketch_hash(hash_key(key));
+    uint64_t h2 = sketch_hash(h1) | 1;
+    int seen = 1;
+    for (int i = 0; i < sk->bloom_hashes; i++) {
+        size_t bit = (h1 + i * h2) & (BLOOM_BITS - 1);
+        if (!(sk->bloom[bit >> 3] >> (bit & 7) & 1)) {
+            seen = 0;
+            sk->bloom[bit >> 3] |= 1 << (bit & 7);
+            sk->bloom_set++;
+        }
+    }
+    if (!seen) {
+        double fp = pow((double)sk->bloom_set / BLOOM_BITS, sk->bloom_hashes);
+        sk->bloom_dropped += fp / (1 - fp);
+    }
+    return seen;
+}
+
+//Function to find the HyperLogLog of a week start, allocating it on first use if create is set
+//Returns NULL for an unknown week without create, or once every slot is taken
+hll * sketch_week(sketch_set * sk, int day, int create) {
+    int i = hash_group(day, 0, 0) & (MAX_SKETCH_WEEKS - 1);
+    for (int probes = 0; probes < MAX_SKETCH_WEEKS; probes++) {
+        if (sk->weeks[i].registers == NULL) {
+            if (!create) {
+                return NULL;
+            }
+            sk->week_days[i] = day;
+            hll_init(sk, &sk->weeks[i], sk->week_precision);
+            return &sk->weeks[i];
+        }
+        if (sk->week_days[i] == day) {
+            return &sk->weeks[i];
+        }
+        i = (i + 1) & (MAX_SKETCH_WEEKS - 1);
+    }
+    return NULL;
+}
+
+//Function to find the Count-Min cells of a (zip, month, year) group, one per row of the sketch, as offsets
+//into counts (or negatives)
+static inline void sketch_cells(sketch_set * sk, int zip, int month, int year, size_t cells[SKETCH_DEPTH]) {
+    uint64_t h = sketch_hash(hash_group(zip, month, year));
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    for (int i = 0; i < SKETCH_DEPTH; i++) {
+        cells[i] = ((size_t)i * sk->width + (h1 + i * h2) % sk->width) * 3;
+    }
+}
+
+//Function to raise a group's cells of metric m by a value >= 0, conservatively: a cell is only raised to the
+//group's new smallest estimate, which keeps the Count-Min bound but overestimates far less
+static inline void sketch_raise(long long * counts, const size_t cells[SKETCH_DEPTH], int m, long long value) {
+    long long least = LLONG_MAX;
+    for (int i = 0; i < SKETCH_DEPTH; i++) {
+        least = counts[cells[i] + m] < least ? counts[cells[i] + m] : least;
+    }
+    for (int i = 0; i < SKETCH_DEPTH; i++) {
+        if (counts[cells[i] + m] < least + value) {
+            counts[cells[i] + m] = least + value;
+        }
+    }
+}
+
+//Function to find the smallest of a group's cells of metric m, its Count-Min estimate
+static inline long long sketch_least(const long long * counts, const size_t cells[SKETCH_DEPTH], int m) {
+    long long least = LLONG_MAX;
+    for (int i = 0; i < SKETCH_DEPTH; i++) {
+        least = counts[cells[i] + m] < least ? counts[cells[i] + m] : least;
+    }
+    return least;
+}
+
+//Function to add one unique row to every sketch
+//Conservative update only keeps its bound while cells never go down, so a negative value raises the
+//group in a second sketch of negative magnitudes instead; a month estimate is the difference of the two
+void sketch_add(sketch_set * sk, const record_key * key) {
+    int year;
+    int month;
+    int mday;
+    day_to_date(key->day, &year, &month, &mday);
+    size_t cells[SKETCH_DEPTH];
+    sketch_cells(sk, key->zip, month, year, cells);
+    const int values[METRIC_POSITIVITY] = {key->cases, key->tests, key->deaths};
+    for (int m = 0; m < METRIC_POSITIVITY; m++) {
+        if (values[m] >= 0) {
+            sk->totals[m] += values[m];
+            sketch_raise(sk->counts, cells, m, values[m]);
+            continue;
+        }
+        if (sk->negatives == NULL) {
+            sk->negatives = sketch_alloc(sk, (size_t)SKETCH_DEPTH * sk->width * 3 * sizeof(long long));
+        }
+        sk->negative_totals[m] -= values[m];
+        sketch_raise(sk->negatives, cells, m, -(long long)values[m]);
+    }
+    uint64_t z = sketch_hash((uint32_t)key->zip);
+    hll_add(&sk->zips, z);
+    hll * week = sketch_week(sk, key->day, 1);
+    if (week != NULL) {
+        hll_add(week, z);
+    }
+    else {
+        sk->weeks_dropped++;
+    }
+    for (int m = 0; m < METRIC_POSITIVITY; m++) {
+        if (values[m] > 0) {
+            heavy_add(&sk->heavy[m], key->zip, values[m]);
+        }
+    }
+}
+
+//Function to stream every row of the data files into the sketches, one file after another
+//Nothing grows with the data: the row counters go to st->stats and the unique rows count as spilled
+void ingest_sketches(char ** paths, int nshards, sketch_set * sk, store * st) {
+    field record[NO_OF_FIELDS];
+    for (int f = 0; f < nshards; f++) {
+        double start = collect_timings ? now_seconds() : 0;
+        text_reader reader;
+        const char * pos;
+        const char * end;
+        reader_open(&reader, paths[f]);
+        while (reader_next(&reader, &pos, &end)) {
+            while (pos < end) {
+                int count = tokenize_row(pos, end, record, NO_OF_FIELDS, &pos);
+                record_key key;
+                st->stats.rows_read++;
+                if (parse_record(record, count, &key, NULL) != 0) {
+                    st->stats.rows_rejected++;
+                    continue;
+                }
+                if (sketch_seen(sk, &key)) {
+                    st->stats.duplicates++;
+                    continue;
+                }
+                sketch_add(sk, &key);
+                st->stats.spilled++;
+            }
+        }
+        st->bytes += reader.bytes;
+        reader_close(&reader);
+        if (collect_timings) {
+            st->stats.parse_seconds += now_seconds() - start;
+        }
+    }
+    if (sk->weeks_dropped > 0) {
+        fprintf(stderr, "warning: more than %d week starts, %d rows only counted towards distinct zips *\n",
+                MAX_SKETCH_WEEKS, sk->weeks_dropped);
+    }
+    if (sk->bloom_dropped > sk->error / 2 * st->stats.spilled) {
+        fprintf(stderr, "warning: %zu unique rows overfill the duplicate filter (sized for %zu at error %g), "
+                "about %.0f of them were dropped as duplicates, so totals may be that much low\n",
+                st->stats.spilled, sk->bloom_capacity, sk->error, sk->bloom_dropped);
+    }
+}
+
+//Function to check whether the sketches can answer a prompt: month totals, heavy hitters and distinct zips
+static inline int sketch_answers(const query * q) {
+    return q->kind == QUERY_MONTH || q->kind == QUERY_HEAVY || q->kind == QUERY_DISTINCT;
+}
+
+//Function to answer a prompt from the sketches, returns -1 for a prompt they cannot answer
+//Each answer carries its bound: a month total overestimates by at most e / width times the total of the
+//metric's positive values with 99% probability, and underestimates by at most e / width times the total
+//magnitude of its negative values; a heavy hitter's count is over by at most the largest Space-Saving error
+//of the zips listed, and a distinct count has a standard error of 1.04 / sqrt(2^precision) of the estimate
+int sketch_query(sketch_set * sk, query * q) {
+    q->approximate = 1;
+    if (q->kind == QUERY_MONTH) {
+        size_t cells[SKETCH_DEPTH];
+        sketch_cells(sk, q->zip, q->month, q->year, cells);
+        long long best[3];
+        for (int m = 0; m < 3; m++) {
+            best[m] = sketch_least(sk->counts, cells, m);
+            if (sk->negatives != NULL) {
+                best[m] -= sketch_least(sk->negatives, cells, m);
+            }
+            q->bound[m] = (long long)ceil(M_E / sk->width * sk->totals[m]);
+            q->under[m] = (long long)ceil(M_E / sk->width * sk->negative_totals[m]);
+        }
+        q->cases = best[0];
+        q->tests = best[1];
+        q->deaths = best[2];
+        return 0;
+    }
+    if (q->kind == QUERY_HEAVY) {
+        const heavy_table * t = &sk->heavy[q->metric];
+        int cap = q->k < t->count ? q->k : t->count;
+        rank_entry * heap = malloc((cap > 0 ? cap : 1) * sizeof(rank_entry));
+        if (heap == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        int n = 0;
+        for (int i = 0; i < t->count; i++) {
+            rank_entry e = {t->heap[i].zip, t->heap[i].count};
+            rank_push(heap, &n, cap, &e, 1);
+        }
+        rank_finish(heap, n, 1);
+        q->ranked = heap;
+        q->nranked = n;
+        for (int i = 0; i < n; i++) {
+            long long error = t->heap[t->slot_pos[heavy_slot(t, heap[i].zip)]].error;
+            q->bound[0] = error > q->bound[0] ? error : q->bound[0];
+        }
+        return 0;
+    }
+    if (q->kind == QUERY_DISTINCT) {
+        const hll * h = &sk->zips;
+        if (q->zip != ALL_ZIPS) {
+            h = sketch_week(sk, q->start, 0);
+            double week_error = 1.04 / sqrt((double)(1 << sk->week_precision));
+            if (week_error > sk->error && !sk->week_warned) {
+                fprintf(stderr, "warning: distinct zips of a week start have a standard error of %.1f%%, above the "
+                        "requested %g\n", 100 * week_error, sk->error);
+                sk->week_warned = 1;
+            }
+        }
+        q->matched = h != NULL ? (int)llround(hll_estimate(h)) : 0;
+        q->bound[0] = h != NULL ? (long long)ceil(1.04 / sqrt((double)(1 << h->precision)) * q->matched) : 0;
+        return 0;
+    }
+    return -1;
+}
+
+//Function to answer queries read line by line from in, one line each on out in the write_file format
+//A query is "zip month year" or "zip start_date end_date" (zip may be * for a range), blank lines are skipped
+void serve_stream(FILE * in, FILE * out, store * dataset, const series_index * series) {
+    char * line = NULL;
+    size_t len = 0;
+    while (getline(&line, &len, in) != -1) {
+        char tokens[10][64];
+        query q;
+        int n = sscanf(line, "%63s %63s %63s %63s %63s %63s %63s %63s %63s %63s", tokens[0], tokens[1], tokens[2],
+                       tokens[3], tokens[4], tokens[5], tokens[6], tokens[7], tokens[8], tokens[9]);
+        if (n != EOF && parse_query(tokens, n, &q) == 0) {
+            answer_query(&q, dataset, series);
+            print_result(out, &q);
+            query_free(&q);
+        }
+        else if (n != EOF) {
+            fprintf(out, "error: expected zip month year, zip start_date end_date, top|bottom K metric month year, "
+                    "box lon1 lat1 lon2 lat2 month year month year, radius lon lat km month year month year, "
+                    "heavy K metric or distinct zips start_date|*\n");
+        }
+        fflush(out);
+    }
+    free(line);
+}
+
+//A connected client and the data it queries
+typedef struct client {
+  int fd;
+  store * dataset;
+  const series_index * series;
+} client;
+
+//Connection thread: answer one client until it disconnects, the store and series are read-only by now
+void * serve_client(void * arg) {
+    client * c = arg;
+    FILE * in = fdopen(c->fd, "r");
+    FILE * out = fdopen(dup(c->fd), "w");
+    if (in != NULL && out != NULL) {
+        serve_stream(in, out, c->dataset, c->series);
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+    free(c);
+    return NULL;
+}
+
+//Function to serve queries on a Unix domain socket, one thread per connection, until killed
+int serve_socket(const char * path, store * dataset, const series_index * series) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return EXIT_FAILURE;
+    }
+    //A client hanging up mid-reply must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        perror("bind");
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "serving %zu records on %s\n", store_count(dataset), path);
+    for (;;) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            return EXIT_FAILURE;
+        }
+        client * c = malloc(sizeof(client));
+        pthread_t thread;
+        if (c == NULL) {
+            close(conn);
+            continue;
+        }
+        c->fd = conn;
+        c->dataset = dataset;
+        c->series = series;
+        if (pthread_create(&thread, NULL, serve_client, c) != 0) {
+            perror("pthread_create");
+            close(conn);
+            free(c);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+//Function to write the phase timings and sizes of a run as one JSON object
+void write_timings(const char * path, const run_timings * t, store * dataset, int nfiles, int nprompts) {
+    FILE * fout = fopen(path, "w");
+    if (fout == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    const ingest_stats * s = &dataset->stats;
+    fprintf(fout, "{\"files\": %d, \"bytes\": %zu, \"records\": %zu, \"groups\": %zu, \"prompts\": %d, "
+            "\"ingest_s\": %.6f, \"parse_s\": %.6f, \"dedup_s\": %.6f, \"merge_s\": %.6f, "
+            "\"index_s\": %.6f, \"query_s\": %.6f, \"output_s\": %.6f}\n",
+            nfiles, dataset->bytes, store_count(dataset) + s->spilled, dataset->groups.count, nprompts,
+            t->ingest.wall, s->parse_seconds, s->dedup_seconds, t->merge.wall, t->index.wall, t->query.wall, t->output.wall);
+    fclose(fout);
+}
+
+//Function to print one line of the --stats phase table
+void print_phase(const char * name, double wall, double cpu) {
+    if (cpu < 0) {
+        fprintf(stderr, "  %-8s %10.3f ms  %10s\n", name, wall * 1e3, "-");
+    }
+    else {
+        fprintf(stderr, "  %-8s %10.3f ms  %10.3f ms\n", name, wall * 1e3, cpu * 1e3);
+    }
+}
+
+//Function to print the --stats report on stderr
+//io, parse and dedup are thread time summed over the workers, so there is no separate CPU figure for them
+void print_stats(const run_timings * t, store * dataset, int nfiles) {
+    const ingest_stats * s = &dataset->stats;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "phase           wall         cpu\n");
+    print_phase("ingest", t->ingest.wall, t->ingest.cpu);
+    print_phase(" io", s->io_seconds, -1);
+    print_phase(" parse", s->parse_seconds, -1);
+    print_phase(" dedup", s->dedup_seconds, -1);
+    print_phase(" merge", t->merge.wall, t->merge.cpu);
+    print_phase("index", t->index.wall, t->index.cpu);
+    print_phase("query", t->query.wall, t->query.cpu);
+    print_phase("output", t->output.wall, t->output.cpu);
+    fprintf(stderr, "files %d  bytes %zu  %.1f MB/s\n", nfiles, dataset->bytes,
+            t->ingest.wall > 0 ? dataset->bytes / t->ingest.wall / 1e6 : 0.0);
+    fprintf(stderr, "rows read %zu  rejected %zu  duplicates dropped %zu  unique %zu  groups %zu\n",
+            s->rows_read, s->rows_rejected, s->duplicates, store_count(dataset) + s->spilled, dataset->groups.count);
+    fprintf(stderr, "peak rss %ld KB\n", usage.ru_maxrss);
+}
+
+//Function to parse a whole decimal count of at least min that fits an int, returns -1 if it is malformed
+int parse_count(const char * arg, long min, long * value) {
+    char * end;
+    errno = 0;
+    *value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || *value < min || *value > INT_MAX) {
+        return -1;
+    }
+    return 0;
+}
+
+//Function to print command line usage
+void usage(const char * prog) {
+    fprintf(stderr, "usage: %s [-n shards] [-p pattern] [-j threads] [-C] [-k checkpoint] [-M budget] [-X error] [-T timings] [--stats] infile outfile [datafile...]\n", prog);
+    fprintf(stderr, "       %s -s|-S socket [-n shards] [-p pattern] [-j threads] [-C] [-k checkpoint] [datafile...]\n", prog);
+    fprintf(stderr, "       %s -G groups [-A aggregates] [-n shards] [-p pattern] outfile [datafile...]\n", prog);
+    fprintf(stderr, "       %s -R [-w weeks] [-n shards] [-p pattern] [-j threads] [-C] [-k checkpoint] outfile [datafile...]\n", prog);
+    fprintf(stderr, "       %s --bench-ingest datafile...\n", prog);
+    fprintf(stderr, "       %s --check-tokenizer datafile...\n", prog);
+    fprintf(stderr, "  -n shards   number of data files to read (default 15)\n");
+    fprintf(stderr, "  -p pattern  data file path with %%d for the shard number (default ../data/covid_%%d.csv)\n");
+    fprintf(stderr, "  -j threads  ingest threads (default: online CPUs)\n");
+    fprintf(stderr, "  -C          do not read or write the binary .cache sidecars\n");
+    fprintf(stderr, "  -M budget   out-of-core: spill rows by zip to temporary files, then dedup each within budget (e.g. 512M)\n");
+    fprintf(stderr, "  -X error    approximate mode: answer month, heavy and distinct prompts from fixed-size sketches\n");
+    fprintf(stderr, "              of the row stream, within the relative error bound (e.g. 0.01)\n");
+    fprintf(stderr, "  --stats     print per-phase wall/CPU time, row counts, throughput and peak RSS on stderr\n");
+    fprintf(stderr, "  -T file     write per-phase timings (ingest, parse, dedup, merge, query, output) as JSON\n");
+    fprintf(stderr, "  -k file     incremental ingest: keep the ingested state in file and only parse appended rows\n");
+    fprintf(stderr, "  -s          load the data once, then answer query lines from stdin on stdout\n");
+    fprintf(stderr, "  -S socket   load the data once, then answer queries on a Unix domain socket\n");
+    fprintf(stderr, "  -G groups   group-by mode: comma separated zip, week, month, year (may be empty)\n");
+    fprintf(stderr, "  -A aggs     comma separated sum|min|max|avg|count:column or count, written as CSV to outfile\n");
+    fprintf(stderr, "  -R          rolling mode: per zip and week, write the rolling average, week-over-week delta\n");
+    fprintf(stderr, "              and cumulative cases, tests and deaths as CSV to outfile\n");
+    fprintf(stderr, "  -w weeks    rolling average window in weeks (default 4)\n");
+    fprintf(stderr, "  datafile    explicit data files, used instead of -n/-p\n");
+}
+
+//Function to tokenize a file the way covid.c originally did (getline, sscanf into a buffer, strtok)
+//Kept only as the baseline for --bench-ingest, returns the number of 21-field rows
+long legacy_tokenize_file(const char * path) {
+    FILE * fd = fopen(path, "r");
+    char buffer[256];
+    long rows = 0;
+    int number;
+    if (fd == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    char *line = NULL;
+    size_t len = 0;
+    while (getline(&line, &len, fd) != -1) {
+        char * record[NO_OF_FIELDS];
+        int count = 0;
+        sscanf(line,"%255s %d",buffer,&number);
+        char * token = strtok(buffer, ",");
+        while (token != NULL && count < NO_OF_FIELDS) {
+            record[count++] = token;
+            token = strtok(NULL, ",");
+        }
+        rows += count == NO_OF_FIELDS && token == NULL && record[0][0] != '\0';
+        free(line);
+        line = NULL;
+    }
+    free(line);
+    fclose(fd);
+    return rows;
+}
+
+//Function to tokenize a file through map_file with the given kernel, returns the number of 21-field rows
+long mapped_tokenize_file(const char * path, tokenizer kernel) {
+    size_t size;
+    const char * map = map_file(path, &size);
+    const char * pos = map;
+    const char * end = map + size;
+    field record[NO_OF_FIELDS];
+    long rows = 0;
+    while (pos < end) {
+        rows += kernel(pos, end, record, NO_OF_FIELDS, &pos) == NO_OF_FIELDS && record[0].len != 0;
+    }
+    if (map != NULL) {
+        munmap((void *)map, size);
+    }
+    return rows;
+}
+
+//Function to compare one tokenizer against the scalar one over [pos, end)
+//Returns the number of rows that split differently, printing the first few
+long check_tokenizer_range(const char * what, const char * name, tokenizer kernel, const char * pos, const char * end) {
+    field expect[NO_OF_FIELDS];
+    field got[NO_OF_FIELDS];
+    long row = 0;
+    long mismatches = 0;
+    while (pos < end) {
+        const char * expect_next;
+        const char * got_next;
+        int expect_count = tokenize_scalar(pos, end, expect, NO_OF_FIELDS, &expect_next);
+        int got_count = kernel(pos, end, got, NO_OF_FIELDS, &got_next);
+        int same = expect_count == got_count && expect_next == got_next;
+        for (int i = 0; same && i < expect_count && i < NO_OF_FIELDS; i++) {
+            same = expect[i].ptr == got[i].ptr && expect[i].len == got[i].len;
+        }
+        if (!same && mismatches++ < 5) {
+            fprintf(stderr, "%s: %s differs from scalar at row %ld (%d vs %d fields)\n", what, name, row, got_count, expect_count);
+        }
+        pos = expect_next;
+        row++;
+    }
+    return mismatches;
+}
+
+//Function to check every vector tokenizer against the scalar one
+//over edge-case rows (quotes, empty fields, CRLF, vector-width boundaries) and the given data files
+int check_tokenizers(int nfiles, char * files[]) {
+    static const char * cases[] = {
+        "60644,18,04/26/2020,05/02/2020,149,747,312,1565.6,743,2261,1557,4738.8,0.2,0.3,16,45,33.5,94.3,47712,60644-2020-18,\"POINT (-87.756863 41.881113)\"\n",
+        "60624,11,03/08/2020,03/14/2020,,,,,9,10,25,27.7,0.0,0.0,0,0,0.0,0.0,36158,60624-2020-11,POINT (-87.722735 41.879417)\r\n",
+        ",,,,,,,,,,,,,,,,,,,,\n\n,\n",
+        "\"a,b\",\"line\nbreak\",\"x\"\"y\",\"\",z\n\"unterminated,quote",
+        "0123456789abcde,\"0123456789abcdef0123456789abcde\",0123456789abcdef0123456789abcdef,\n",
+    };
+    const char * names[4];
+    tokenizer kernels[4];
+    int nkernels = available_tokenizers(names, kernels);
+    long mismatches = 0;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        //Check every suffix so each byte lands on every lane of the vector
+        size_t len = strlen(cases[c]);
+        for (size_t offset = 0; offset < len; offset++) {
+            for (int k = 1; k < nkernels; k++) {
+                mismatches += check_tokenizer_range("edge case", names[k], kernels[k], cases[c] + offset, cases[c] + len);
+            }
+        }
+    }
+    for (int f = 0; f < nfiles; f++) {
+        size_t size;
+        const char * map = map_file(files[f], &size);
+        for (int k = 1; k < nkernels; k++) {
+            mismatches += check_tokenizer_range(files[f], names[k], kernels[k], map, map + size);
+        }
+        if (map != NULL) {
+            munmap((void *)map, size);
+        }
+    }
+    printf("%d tokenizers checked, %ld mismatches\n", nkernels, mismatches);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//Function to benchmark the legacy loop and each mmap tokenizer over the given files
+//Each file is tokenized several times and the best bytes/sec is reported
+int bench_ingest(int nfiles, char * files[]) {
+    const int rounds = 5;
+    printf("%-32s %12s %10s %10s %12s\n", "file", "bytes", "tokenizer", "rows", "MB/s");
+    for (int f = 0; f < nfiles; f++) {
+        struct stat st;
+        if (stat(files[f], &st) != 0) {
+            fprintf(stderr, "%s: %s\n", files[f], strerror(errno));
+            return EXIT_FAILURE;
+        }
+        //Entry 0 is the legacy loop, the rest are the mmap tokenizers
+        const char * names[5] = {"legacy"};
+        tokenizer kernels[5] = {NULL};
+        int nkernels = 1 + available_tokenizers(names + 1, kernels + 1);
+        for (int t = 0; t < nkernels; t++) {
+            double best = 0;
+            long rows = 0;
+            for (int r = 0; r < rounds; r++) {
+                double start = now_seconds();
+                rows = t == 0 ? legacy_tokenize_file(files[f]) : mapped_tokenize_file(files[f], kernels[t]);
+                double elapsed = now_seconds() - start;
+                if (best == 0 || elapsed < best) {
+                    best = elapsed;
+                }
+            }
+            printf("%-32s %12lld %10s %10ld %12.1f\n", files[f], (long long)st.st_size, names[t], rows,
+                   best > 0 ? st.st_size / best / 1e6 : 0.0);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]){
+    //Benchmark and self-check modes: covid --bench-ingest file..., covid --check-tokenizer file...
+    if (argc > 1 && strcmp(argv[1], "--bench-ingest") == 0) {
+        return bench_ingest(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "--check-tokenizer") == 0) {
+        return check_tokenizers(argc - 2, argv + 2);
+    }
+    select_tokenizer();
+
+    //Defining defaults for file I/O, overridable from the command line
+    const char * pattern = "../data/covid_%d.csv";
+    int no_of_files = 15;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int use_cache = 1;
+    int serve = 0;
+    const char * socket_path = NULL;
+    const char * group_spec = NULL;
+    const char * agg_spec_list = "";
+    const char * checkpoint_path = NULL;
+    const char * timings_path = NULL;
+    int show_stats = 0;
+    size_t spill_budget = 0;
+    int rolling = 0;
+    int window = 4;
+    double sketch_error = 0;
+    static const struct option long_options[] = {
+        {"stats", no_argument, NULL, 1},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    long count;
+    while ((opt = getopt_long(argc, argv, "n:p:j:CsS:G:A:k:T:M:Rw:X:", long_options, NULL)) != -1) {
+        if (opt == 'n') {
+            if (parse_count(optarg, 1, &count) != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            no_of_files = count;
+        }
+        else if (opt == 'p') {
+            pattern = optarg;
+        }
+        else if (opt == 'j') {
+            if (parse_count(optarg, 1, &nthreads) != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (opt == 'C') {
+            use_cache = 0;
+        }
+        else if (opt == 's') {
+            serve = 1;
+        }
+        else if (opt == 'S') {
+            serve = 1;
+            socket_path = optarg;
+        }
+        else if (opt == 'G') {
+            group_spec = optarg;
+        }
+        else if (opt == 'k') {
+            checkpoint_path = optarg;
+        }
+        else if (opt == 'T') {
+            timings_path = optarg;
+            collect_timings = 1;
+        }
+        else if (opt == 'R') {
+            rolling = 1;
+        }
+        else if (opt == 'w') {
+            if (parse_count(optarg, 1, &count) != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            window = count;
+        }
+        else if (opt == 'X') {
+            char * end;
+            sketch_error = strtod(optarg, &end);
+            if (*end != '\0' || !(sketch_error >= MIN_SKETCH_ERROR && sketch_error < 1)) {
+                fprintf(stderr, "invalid error bound: %s (between %g and 1)\n", optarg, MIN_SKETCH_ERROR);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (opt == 'M') {
+            spill_budget = parse_size(optarg);
+            if (spill_budget == 0) {
+                fprintf(stderr, "invalid memory budget: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (opt == 1) {
+            show_stats = 1;
+            collect_timings = 1;
+        }
+        else if (opt == 'A') {
+            agg_spec_list = optarg;
+            if (group_spec == NULL) {
+                group_spec = "";
+            }
+        }
+        else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    //Batch mode takes infile and outfile before the data files, group-by and rolling mode only outfile, server mode neither
+    groupby_plan plan;
+    if (group_spec != NULL && groupby_parse(group_spec, agg_spec_list, &plan) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (rolling && (serve || group_spec != NULL)) {
+        fprintf(stderr, "-R cannot be combined with -s, -S or -G\n");
+        return EXIT_FAILURE;
+    }
+    if (serve && group_spec != NULL) {
+        fprintf(stderr, "-G and -A cannot be combined with -s or -S\n");
+        return EXIT_FAILURE;
+    }
+    int npositional = serve ? 0 : group_spec != NULL || rolling ? 1 : 2;
+    //Out-of-core mode answers the prompts of one batch run, it cannot serve or checkpoint
+    if (spill_budget != 0 && npositional != 2) {
+        fprintf(stderr, "-M only works with an infile and outfile\n");
+        return EXIT_FAILURE;
+    }
+    if (spill_budget != 0 && checkpoint_path != NULL) {
+        fprintf(stderr, "-M and -k cannot be combined\n");
+        return EXIT_FAILURE;
+    }
+    //Approximate mode answers the prompts of one batch run from sketches of the row stream only
+    if (sketch_error != 0 && (npositional != 2 || spill_budget != 0 || checkpoint_path != NULL)) {
+        fprintf(stderr, "-X only works with an infile and outfile, without -M or -k\n");
+        return EXIT_FAILURE;
+    }
+    if (argc - optind < npositional || no_of_files < 1 || strstr(pattern, "%d") == NULL) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    //The outfile is always the last positional before the data files, server mode has none
+    const char * outfile = npositional > 0 ? argv[optind + npositional - 1] : NULL;
+    
+    // Number of sets of input given in the input file
+    int data_entry_prompts = 0;
+
+    //Memory allocation for output struct, doubled whenever the input file has more prompts
+    int output_size = 128;
+    query* output = malloc(sizeof(query) * output_size);
+    int index_prompts = 0;
+
+    if (npositional == 2) {
+        char* infile = argv[optind];
+
+        // Instantiate a file pointer
+        FILE* fileP;
+        fileP = fopen(infile, "r");
+
+        // While File pointer is not null
+        if (fileP != NULL) {
+            //Prompts are read as whitespace separated tokens, three at a time or more for the longer forms
+            char tokens[9][64];
+            int index = 0;
+            while(fscanf(fileP, "%63s", tokens[index]) != EOF) {
+                if (++index < query_tokens(tokens[0])) {
+                    continue;
+                }
+                //Resetting index
+                index = 0;
+                if (data_entry_prompts == output_size) {
+                    output_size *= 2;
+                    output = realloc(output, sizeof(query) * output_size);
+                    if (output == NULL) {
+                        perror("realloc");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                if (parse_query(tokens, query_tokens(tokens[0]), &output[data_entry_prompts]) != 0) {
+                    fprintf(stderr, "skipping invalid prompt: %s %s %s%s\n", tokens[0], tokens[1], tokens[2],
+                            query_tokens(tokens[0]) > 3 ? " ..." : "");
+                    continue;
+                }
+                if (sketch_error != 0 && !sketch_answers(&output[data_entry_prompts])) {
+                    fprintf(stderr, "skipping prompt the sketches cannot answer (run without -X): %s %s %s%s\n",
+                            tokens[0], tokens[1], tokens[2], query_tokens(tokens[0]) > 3 ? " ..." : "");
+                    continue;
+                }
+                index_prompts += output[data_entry_prompts++].kind != QUERY_MONTH;
+            }
+            fclose(fileP);
+        } 
+        else {
+            //File error condition
+            perror("fopen"); 
+            exit(EXIT_FAILURE); 
+        }
+
+        printf("\n");
+    }
+
+    //Shard paths come from the explicit list if one was given, otherwise from the pattern
+    int nshards = argc - optind - npositional;
+    char ** paths;
+    if (nshards > 0) {
+        paths = argv + optind + npositional;
+    }
+    else {
+        nshards = no_of_files;
+        paths = malloc(nshards * sizeof(char *));
+        for (int i = 0; i < nshards; i++) {
+            paths[i] = shard_path(pattern, i + 1);
+        }
+    }
+
+    //Group-by mode streams the files straight into its own table instead of the record store
+    if (group_spec != NULL) {
+        groupby_table table;
+        groupby_init(&table, plan.naggs);
+        groupby_scan(paths, nshards, &plan, &table);
+        groupby_write(&table, &plan, outfile);
+        groupby_free(&table);
+        if (paths != argv + optind + npositional) {
+            for (int i = 0; i < nshards; i++) {
+                free(paths[i]);
+            }
+            free(paths);
+        }
+        free(output);
+        return EXIT_SUCCESS;
+    }
+
+    //Every shard is parsed in parallel, then merged and deduplicated across shards
+    store dataset;
+    store_init(&dataset);
+    run_timings timings;
+    memset(&timings, 0, sizeof(timings));
+    sketch_set sketches;
+    phase_begin(&timings.ingest);
+    if (sketch_error != 0) {
+        sketch_init(&sketches, sketch_error);
+        ingest_sketches(paths, nshards, &sketches, &dataset);
+    }
+    else if (spill_budget != 0) {
+        ingest_spilled(paths, nshards, spill_budget, output, data_entry_prompts, &dataset);
+    }
+    else if (checkpoint_path != NULL) {
+        ingest_incremental(checkpoint_path, paths, nshards, nthreads, use_cache, &dataset);
+    }
+    else {
+        ingest_shards(paths, nshards, nthreads, use_cache, &dataset, NULL);
+    }
+    phase_end(&timings.ingest);
+    timings.merge = merge_phase;
+    if (paths != argv + optind + npositional) {
+        for (int i = 0; i < nshards; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+    }
+
+    //Date-range and ranking queries are answered from the series index, built only when something can ask for them
+    series_index series;
+    int have_series = serve || rolling || (index_prompts > 0 && sketch_error == 0);
+    phase_begin(&timings.index);
+    if (have_series) {
+        series_build(&dataset, &series);
+    }
+    phase_end(&timings.index);
+
+    //Server mode answers queries against the loaded data until stdin closes or the process is killed
+    int status = EXIT_SUCCESS;
+    if (rolling) {
+        phase_begin(&timings.output);
+        write_rolling(&series, outfile, window);
+        phase_end(&timings.output);
+    }
+    else if (serve) {
+        if (socket_path != NULL) {
+            status = serve_socket(socket_path, &dataset, &series);
+        }
+        else {
+            serve_stream(stdin, stdout, &dataset, &series);
+        }
+    }
+    else {
+        //Iterate over input file to find prompts
+        phase_begin(&timings.query);
+        for (int m=0; m<data_entry_prompts; m++){
+            if (sketch_error != 0) {
+                sketch_query(&sketches, &output[m]);
+            }
+            //Out-of-core runs have already answered these over the partitions
+            else if (spill_budget == 0 || !query_partitioned(&output[m])) {
+                answer_query(&output[m], &dataset, have_series ? &series : NULL);
+            }
+        }
+        phase_end(&timings.query);
+        //Call function to write to outfile
+        phase_begin(&timings.output);
+        write_file(output, outfile, data_entry_prompts);
+        phase_end(&timings.output);
+    }
+    if (timings_path != NULL) {
+        write_timings(timings_path, &timings, &dataset, nshards, data_entry_prompts);
+    }
+    if (show_stats) {
+        print_stats(&timings, &dataset, nshards);
+        if (sketch_error != 0) {
+            fprintf(stderr, "sketches %zu KB for error %g  duplicate filter sized for %zu rows, about %.0f unique dropped\n",
+                    sketches.bytes >> 10, sketch_error, sketches.bloom_capacity, sketches.bloom_dropped);
+        }
+    }
+
+    //Free open pointers
+    if (have_series) {
+        series_free(&series);
+    }
+    if (sketch_error != 0) {
+        sketch_free(&sketches);
+    }
+    store_free(&dataset);
+    for (int m = 0; m < data_entry_prompts; m++) {
+        query_free(&output[m]);
+    }
+    free(output);
+    return status;
+}
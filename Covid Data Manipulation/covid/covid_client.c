@@ -0,0 +1,166 @@
+//Client for the covid query server (covid -S socket)
+//Sends "zip month year" queries and prints the answers, or measures round-trip latency with -b
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//Function to return monotonic time in seconds
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Function to connect to the server socket, exits on failure
+int connect_server(const char * path) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+//Function to send one query line and read back the one-line answer into *reply
+//Returns -1 if the server hung up
+int round_trip(FILE * to, FILE * from, const char * query, char ** reply, size_t * len) {
+    fputs(query, to);
+    fputc('\n', to);
+    fflush(to);
+    return getline(reply, len, from) == -1 ? -1 : 0;
+}
+
+//Function to compare latencies for qsort
+int compare_double(const void * a, const void * b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+//Function to read every non-blank query line of fin, returns the count
+int read_queries(FILE * fin, char *** queries) {
+    char * line = NULL;
+    size_t len = 0;
+    int count = 0;
+    int size = 64;
+    *queries = malloc(size * sizeof(char *));
+    while (getline(&line, &len, fin) != -1) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[strspn(line, " \t")] == '\0') {
+            continue;
+        }
+        if (count == size) {
+            size *= 2;
+            *queries = realloc(*queries, size * sizeof(char *));
+        }
+        if (*queries == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        (*queries)[count++] = strdup(line);
+    }
+    free(line);
+    return count;
+}
+
+//Function to print usage
+void usage(const char * prog) {
+    fprintf(stderr, "usage: %s [-b queries] socket [queryfile]\n", prog);
+    fprintf(stderr, "  without -b, each query line is sent and its answer printed\n");
+    fprintf(stderr, "  with -b, the queries are replayed round robin and p50/p99 latency is reported\n");
+}
+
+int main(int argc, char * argv[]) {
+    long bench = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        if (opt == 'b') {
+            bench = atol(optarg);
+        }
+        else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind < 1 || argc - optind > 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE * fin = stdin;
+    if (argc - optind == 2) {
+        fin = fopen(argv[optind + 1], "r");
+        if (fin == NULL) {
+            perror("fopen");
+            return EXIT_FAILURE;
+        }
+    }
+    int fd = connect_server(argv[optind]);
+    FILE * to = fdopen(fd, "w");
+    FILE * from = fdopen(dup(fd), "r");
+    char * reply = NULL;
+    size_t len = 0;
+
+    if (bench <= 0) {
+        //Interactive mode: one round trip per query line
+        char * line = NULL;
+        size_t line_len = 0;
+        while (getline(&line, &line_len, fin) != -1) {
+            line[strcspn(line, "\r\n")] = 0;
+            if (line[strspn(line, " \t")] == '\0') {
+                continue;
+            }
+            if (round_trip(to, from, line, &reply, &len) != 0) {
+                fprintf(stderr, "server closed the connection\n");
+                return EXIT_FAILURE;
+            }
+            fputs(reply, stdout);
+        }
+        free(line);
+        return EXIT_SUCCESS;
+    }
+
+    //Benchmark mode: replay the query file until bench round trips have been timed
+    char ** queries;
+    int nqueries = read_queries(fin, &queries);
+    if (nqueries == 0) {
+        fprintf(stderr, "no queries to replay\n");
+        return EXIT_FAILURE;
+    }
+    double * latency = malloc(bench * sizeof(double));
+    if (latency == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    double start = now_seconds();
+    for (long i = 0; i < bench; i++) {
+        double sent = now_seconds();
+        if (round_trip(to, from, queries[i % nqueries], &reply, &len) != 0) {
+            fprintf(stderr, "server closed the connection\n");
+            return EXIT_FAILURE;
+        }
+        latency[i] = now_seconds() - sent;
+    }
+    double elapsed = now_seconds() - start;
+    qsort(latency, bench, sizeof(double), compare_double);
+    printf("queries %ld  p50 %.1f us  p99 %.1f us  max %.1f us  %.0f queries/s\n", bench,
+           latency[bench / 2] * 1e6, latency[(long)(bench * 0.99)] * 1e6, latency[bench - 1] * 1e6,
+           elapsed > 0 ? bench / elapsed : 0.0);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,48 @@
+//Day number and shard name helpers shared by covid.c and covid_gen.c
+//Both programs are built from a single source file, so the helpers are static inline here
+#ifndef COVID_DATES_H
+#define COVID_DATES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Function to convert a day number back into year, month and day of month (days since 1970-01-01)
+static inline void day_to_date(int day, int * year, int * month, int * mday) {
+    day += 719468;
+    int era = (day >= 0 ? day : day - 146096) / 146097;
+    int doe = day - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    *mday = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2);
+}
+
+//Function to print a day number as MM/DD/YYYY
+static inline void print_date(FILE * fout, int day) {
+    int year;
+    int month;
+    int mday;
+    day_to_date(day, &year, &month, &mday);
+    fprintf(fout, "%02d/%02d/%04d", month, mday, year);
+}
+
+//Function to build a shard path by substituting i for the %d in pattern, the rest is copied as is
+static inline char * shard_path(const char * pattern, int i) {
+    const char * at = strstr(pattern, "%d");
+    char int_str[16];
+    sprintf(int_str, "%d", i);
+    char * name = malloc(strlen(pattern) + strlen(int_str) + 1);
+    if (name == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(name, pattern, at - pattern);
+    strcpy(name + (at - pattern), int_str);
+    strcat(name, at + 2);
+    return name;
+}
+
+#endif
@@ -0,0 +1,236 @@
+//Synthetic dataset generator for covid.c
+//Writes covid_N.csv shards with the same 21 columns as the Chicago export, and optionally a prompt file
+//Every value is a hash of (zip, week), so the same options always produce the same files
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include "covid_dates.h"
+
+//Day number (days since 01/01/1970) of the first Week Start, 03/01/2020
+#define FIRST_DAY 18322
+
+//First synthetic zip code, the rest follow on
+#define FIRST_ZIP 60000
+
+//Function to mix a 64 bit value into a well spread hash (splitmix64 finalizer)
+uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+//Function to write the row for the given zip and week, a repeated call writes the identical row
+void write_row(FILE * fout, long zip_index, long week, int empty_permille) {
+    uint64_t h = mix64((uint64_t)zip_index << 32 | (uint64_t)week);
+    int zip = FIRST_ZIP + (int)zip_index;
+    int day = FIRST_DAY + 7 * (int)week;
+    int year;
+    int month;
+    int mday;
+    day_to_date(day, &year, &month, &mday);
+    //Week Number cycles through 1..52 from the first week
+    int week_number = (day - FIRST_DAY) / 7 % 52 + 1;
+    int population = 1000 + (int)(mix64(zip_index) % 90000);
+    int cases = (int)(h % 400);
+    int tests = cases * 4 + (int)(h >> 16 & 1023);
+    int deaths = (int)((h >> 32) % 8);
+    double rate = population > 0 ? 100000.0 / population : 0;
+    double positive = tests > 0 ? (double)cases / tests : 0;
+    //Some rows leave tests and deaths blank, the way the real export does
+    int blank = (int)(h >> 48 & 1023) < empty_permille;
+
+    fprintf(fout, "%d,%d,", zip, week_number);
+    print_date(fout, day);
+    fputc(',', fout);
+    print_date(fout, day + 6);
+    fprintf(fout, ",%d,%ld,%.0f,%.1f,", cases, (long)cases * (week + 1), cases * rate, cases * rate * (week + 1));
+    if (blank) {
+        fprintf(fout, ",,,,,,,,,,");
+    }
+    else {
+        fprintf(fout, "%d,%ld,%.0f,%.1f,%.1f,%.1f,%d,%ld,%.1f,%.1f,", tests, (long)tests * (week + 1),
+                tests * rate, tests * rate * (week + 1), positive, positive, deaths,
+                (long)deaths * (week + 1), deaths * rate, deaths * rate * (week + 1));
+    }
+    fprintf(fout, "%d,%d-%d-%d,POINT (%.6f %.6f)\n", population, zip, year, week_number,
+            -87.9 + (double)(mix64(zip_index + 1) % 40000) / 100000.0,
+            41.6 + (double)(mix64(zip_index + 2) % 45000) / 100000.0);
+}
+
+//Function to write the prompt file: month prompts and date range prompts over the generated zips and weeks
+void write_prompts(const char * path, long count, long zips, long weeks) {
+    FILE * fout = fopen(path, "w");
+    if (fout == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < count; i++) {
+        uint64_t h = mix64(0x5eed0000ULL + i);
+        long zip = FIRST_ZIP + (long)(h % zips);
+        int day = FIRST_DAY + 7 * (int)((h >> 24) % weeks);
+        int year;
+        int month;
+        int mday;
+        day_to_date(day, &year, &month, &mday);
+        if (i % 4 == 3) {
+            //Every fourth prompt is a range over up to ten weeks, some of them across every zip
+            int end = day + 7 * (int)(h >> 40 & 7) + 6;
+            if (i % 8 == 7) {
+                fprintf(fout, "* ");
+            }
+            else {
+                fprintf(fout, "%ld ", zip);
+            }
+            print_date(fout, day);
+            fputc(' ', fout);
+            print_date(fout, end);
+            fputc('\n', fout);
+        }
+        else {
+            fprintf(fout, "%ld %d %d\n", zip, month, year);
+        }
+    }
+    fclose(fout);
+}
+
+//Function to parse a whole decimal count of at least min that fits an int, returns -1 if it is malformed
+int parse_count(const char * arg, long min, long * value) {
+    char * end;
+    errno = 0;
+    *value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || *value < min || *value > INT_MAX) {
+        return -1;
+    }
+    return 0;
+}
+
+//Function to print usage
+void usage(const char * prog) {
+    fprintf(stderr, "usage: %s [-z zips] [-w weeks] [-d dup_ratio] [-e empty_ratio] [-s shards] [-o pattern] [-q promptfile] [-Q prompts]\n", prog);
+    fprintf(stderr, "  writes zips * weeks unique rows (plus dup_ratio of them again) spread over the shards by hash\n");
+    fprintf(stderr, "  pattern names each shard with %%d, default covid_%%d.csv; shards are numbered from 1\n");
+}
+
+int main(int argc, char * argv[]) {
+    long zips = 60;
+    long weeks = 80;
+    double dup_ratio = 0.05;
+    double empty_ratio = 0.01;
+    int shards = 15;
+    const char * pattern = "covid_%d.csv";
+    const char * prompt_path = NULL;
+    long prompts = 1000;
+    long count;
+    int opt;
+    while ((opt = getopt(argc, argv, "z:w:d:e:s:o:q:Q:")) != -1) {
+        if (opt == 'z') {
+            if (parse_count(optarg, 1, &zips) != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (opt == 'w') {
+            if (parse_count(optarg, 1, &weeks) != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (opt == 'd') {
+            char * end;
+            dup_ratio = strtod(optarg, &end);
+            if (end == optarg || *end != '\0') {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (opt == 'e') {
+            char * end;
+            empty_ratio = strtod(optarg, &end);
+            if (end == optarg || *end != '\0') {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (opt == 's') {
+            if (parse_count(optarg, 1, &count) != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            shards = count;
+        }
+        else if (opt == 'o') {
+            pattern = optarg;
+        }
+        else if (opt == 'q') {
+            prompt_path = optarg;
+        }
+        else if (opt == 'Q') {
+            if (parse_count(optarg, 0, &prompts) != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || zips <= 0 || zips > 39999 || weeks <= 0 || weeks > 5000 || shards <= 0 ||
+        dup_ratio < 0 || dup_ratio > 1 || empty_ratio < 0 || empty_ratio > 1 || strstr(pattern, "%d") == NULL) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE ** out = malloc(shards * sizeof(FILE *));
+    if (out == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < shards; i++) {
+        char * path = shard_path(pattern, i + 1);
+        out[i] = fopen(path, "w");
+        if (out[i] == NULL) {
+            perror(path);
+            return EXIT_FAILURE;
+        }
+        free(path);
+        fprintf(out[i], "ZIP Code,Week Number,Week Start,Week End,Cases - Weekly,Cases - Cumulative,"
+                "Case Rate - Weekly,Case Rate - Cumulative,Tests - Weekly,Tests - Cumulative,"
+                "Test Rate - Weekly,Test Rate - Cumulative,Percent Tested Positive - Weekly,"
+                "Percent Tested Positive - Cumulative,Deaths - Weekly,Deaths - Cumulative,"
+                "Death Rate - Weekly,Death Rate - Cumulative,Population,Row ID,ZIP Code Location\n");
+    }
+
+    //Rows go out week by week, each one to a hashed shard; a duplicate repeats an earlier row into another hashed shard
+    uint64_t dup_cut = (uint64_t)(dup_ratio * 1048576.0);
+    int empty_permille = (int)(empty_ratio * 1024.0);
+    long rows = 0;
+    long duplicates = 0;
+    for (long r = 0; r < zips * weeks; r++) {
+        uint64_t h = mix64((uint64_t)r ^ 0xc0ffee);
+        write_row(out[h % shards], r % zips, r / zips, empty_permille);
+        rows++;
+        if ((h >> 20 & 1048575) < dup_cut) {
+            long j = (long)(h >> 40) % (r + 1);
+            write_row(out[(h >> 8) % shards], j % zips, j / zips, empty_permille);
+            duplicates++;
+        }
+    }
+    for (int i = 0; i < shards; i++) {
+        if (fclose(out[i]) != 0) {
+            perror("fclose");
+            return EXIT_FAILURE;
+        }
+    }
+    free(out);
+    if (prompt_path != NULL) {
+        write_prompts(prompt_path, prompts, zips, weeks);
+    }
+    fprintf(stderr, "%ld unique rows, %ld duplicates, %d shards\n", rows, duplicates, shards);
+    return EXIT_SUCCESS;
+}
@@ -1,5 +1,5 @@
 //Libraries used
-//<fcntl.h> needed for file opening snippet in redirect function 
+//<fcntl.h> needed for the O_RDONLY stdin redirect of each spawned child
 #define _GNU_SOURCE
 #include <sys/types.h>
 #include <stdlib.h>
@@ -8,47 +8,481 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <stdint.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 //External environment 
 extern char **environ;
 
-//Function to add a file redirect for the CNET_ID mode
-int redirect(char * filename)
-{
-  int fd = open(filename, O_RDONLY);
-  if (fd < 0) {
-      perror("open");
-      return EXIT_FAILURE;
-    }
-  dup2(fd, STDIN_FILENO);
-  close(fd);
-  return EXIT_SUCCESS;
+//Structure for one line of the data file in the single-parse index: its file and variable bytes
+//next chains the lines of the same user in file order (-1 ends the chain)
+typedef struct data_line {
+  char * file;
+  int bytecount;
+  int next;
+} data_line;
+
+//Structure for one user of the index: the first and last line of its chain
+typedef struct user_entry {
+  char * CNet;
+  int first;
+  int last;
+} user_entry;
+
+//Per-user index of the data file, parsed once: an open-addressing hash table of CNets (linear probing,
+//grown at 3/4 load) whose slots hold user index + 1 (0 marks an empty slot)
+typedef struct user_index {
+  data_line * lines;
+  int nlines;
+  int lines_size;
+  user_entry * users;
+  int nusers;
+  int users_size;
+  int * slots;
+  int capacity;
+} user_index;
+
+//Path of the du binary each child runs
+#define DU_PATH "../p1/./du"
+
+//Structure for one in-flight child of the spawn pool (pid 0 marks a free slot)
+typedef struct child_slot {
+  pid_t pid;
+  char * CNet;
+} child_slot;
+
+//Function to return monotonic time in seconds
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-//Function to check if all the child processes have been terminated successfully before moving on with the parent process
-int check_child_exit(int child_status, pid_t wpid, int line_no){
-    for (int i = 0; i < line_no; i++) { // Parent 
-        wpid = wait(&child_status);
-        if (WIFEXITED(child_status)){
+//Function to reap one child of the pool, report it if it failed and free its slot
+//Returns 1 if the child failed
+int reap_child(child_slot * slots, int nslots) {
+    int child_status;
+    pid_t wpid;
+    while ((wpid = waitpid(-1, &child_status, 0)) < 0) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < nslots; i++) {
+        if (slots[i].pid != wpid) {
             continue;
         }
-        else{
-            printf("Child %d terminated abnormally\n", wpid);
+        int failed = 1;
+        if (WIFSIGNALED(child_status)) {
+            fprintf(stderr, "Child %d (%s) terminated abnormally: %s\n", wpid, slots[i].CNet, strsignal(WTERMSIG(child_status)));
+        }
+        else if (WEXITSTATUS(child_status) != 0) {
+            fprintf(stderr, "Child %d (%s) exited with status %d\n", wpid, slots[i].CNet, WEXITSTATUS(child_status));
+        }
+        else {
+            failed = 0;
+        }
+        free(slots[i].CNet);
+        slots[i].pid = 0;
+        slots[i].CNet = NULL;
+        return failed;
+    }
+    return 0;
+}
+
+//Function to run one du child per CNet line of in, with at most nslots children in flight at once
+//Each child gets the data file as its stdin through a spawn file action; a slot is refilled as soon as its child
+//is reaped. Per-child failures and the throughput summary go to stderr. Returns the number of failures
+int spawn_pool(FILE * in, const char * redirectfile, int nslots) {
+    child_slot * slots = calloc(nslots, sizeof(child_slot));
+    if (slots == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, redirectfile, O_RDONLY, 0);
+    double start = now_seconds();
+    int running = 0;
+    int spawned = 0;
+    int failures = 0;
+    char * line = NULL;
+    size_t len = 0;
+    while (getline(&line, &len, in) != -1) {
+        line[strcspn(line, "\n")] = 0;
+        if (running == nslots) {
+            failures += reap_child(slots, nslots);
+            running--;
+        }
+        int i = 0;
+        while (slots[i].pid != 0) {
+            i++;
         }
+        char * myargv[] = {DU_PATH, line, NULL};
+        int err = posix_spawn(&slots[i].pid, myargv[0], &actions, NULL, myargv, environ);
+        if (err != 0) {
+            fprintf(stderr, "Could not start %s for %s: %s\n", myargv[0], line, strerror(err));
+            slots[i].pid = 0;
+            failures++;
+            continue;
+        }
+        slots[i].CNet = strdup(line);
+        running++;
+        spawned++;
+    }
+    while (running > 0) {
+        failures += reap_child(slots, nslots);
+        running--;
+    }
+    double elapsed = now_seconds() - start;
+    fprintf(stderr, "%d children, %d failed, %d at a time, %.3f s, %.1f children/s\n", spawned, failures, nslots,
+            elapsed, elapsed > 0 ? spawned / elapsed : 0.0);
+    posix_spawn_file_actions_destroy(&actions);
+    free(line);
+    free(slots);
+    return failures;
+}
+
+//Function to compute the size of each variable type, as du does
+int size_of_var(const char * token) {
+    if (strcmp(token, "char") == 0) {
+        return sizeof(char);
+    }
+    if (strcmp(token, "int") == 0) {
+        return sizeof(int);
+    }
+    if (strcmp(token, "float") == 0) {
+        return sizeof(float);
+    }
+    if (strcmp(token, "double") == 0) {
+        return sizeof(double);
     }
     return 0;
 }
 
-//Fork function (all child processes' functionalities are inside this function)
-void forkfunc(char * name, char * redirectfile, pid_t pid) {
-    int nargc = 2; 
-    char * myargv[] = {"../p1/./du",name,NULL}; 
-    if ((pid = fork()) == 0) {   
-        redirect(redirectfile);
-        execve(myargv[0], myargv, environ); 
-        _exit(EXIT_FAILURE); 
+//Function to hash a string (FNV-1a)
+uint64_t hash_string(const char * str) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *str != '\0'; str++) {
+        h = (h ^ (unsigned char)*str) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+//Function to allocate an empty index
+void index_init(user_index * index) {
+    index->nlines = 0;
+    index->lines_size = 1024;
+    index->nusers = 0;
+    index->users_size = 64;
+    index->capacity = 128;
+    index->lines = malloc(index->lines_size * sizeof(data_line));
+    index->users = malloc(index->users_size * sizeof(user_entry));
+    index->slots = calloc(index->capacity, sizeof(int));
+    if (index->lines == NULL || index->users == NULL || index->slots == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void index_free(user_index * index) {
+    for (int i = 0; i < index->nlines; i++) {
+        free(index->lines[i].file);
+    }
+    for (int u = 0; u < index->nusers; u++) {
+        free(index->users[u].CNet);
+    }
+    free(index->lines);
+    free(index->users);
+    free(index->slots);
+}
+
+//Function to find the slot holding CNet, or the empty slot where it belongs
+int index_probe(const user_index * index, const char * CNet) {
+    int mask = index->capacity - 1;
+    int i = hash_string(CNet) & mask;
+    while (index->slots[i] != 0 && strcmp(index->users[index->slots[i] - 1].CNet, CNet) != 0) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+//Function to get the user index of CNet, or -1 if the data file has no line for it
+int index_find(const user_index * index, const char * CNet) {
+    return index->slots[index_probe(index, CNet)] - 1;
+}
+
+//Function to get the user index of CNet, adding the user with an empty chain the first time it is seen
+int index_user(user_index * index, const char * CNet) {
+    if ((index->nusers + 1) * 4 > index->capacity * 3) {
+        //Double the slot array and reinsert every user
+        free(index->slots);
+        index->capacity *= 2;
+        index->slots = calloc(index->capacity, sizeof(int));
+        if (index->slots == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        for (int u = 0; u < index->nusers; u++) {
+            index->slots[index_probe(index, index->users[u].CNet)] = u + 1;
+        }
+    }
+    int i = index_probe(index, CNet);
+    if (index->slots[i] != 0) {
+        return index->slots[i] - 1;
     }
+    if (index->nusers == index->users_size) {
+        index->users_size *= 2;
+        index->users = realloc(index->users, index->users_size * sizeof(user_entry));
+        if (index->users == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    user_entry * user = &index->users[index->nusers];
+    user->CNet = strdup(CNet);
+    user->first = -1;
+    user->last = -1;
+    index->slots[i] = ++index->nusers;
+    return index->nusers - 1;
+}
+
+//Function to append a line to the end of its user's chain
+void index_add(user_index * index, const char * CNet, const char * file, int bytecount) {
+    int u = index_user(index, CNet);
+    if (index->nlines == index->lines_size) {
+        index->lines_size *= 2;
+        index->lines = realloc(index->lines, index->lines_size * sizeof(data_line));
+        if (index->lines == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    data_line * line = &index->lines[index->nlines];
+    line->file = strdup(file);
+    line->bytecount = bytecount;
+    line->next = -1;
+    if (index->users[u].last >= 0) {
+        index->lines[index->users[u].last].next = index->nlines;
+    }
+    else {
+        index->users[u].first = index->nlines;
+    }
+    index->users[u].last = index->nlines++;
+}
+
+//Function to tokenize one data line in place the way du does, returns the summed variable bytes
+//CNet and file are left NULL when the line is missing them; strtok_r keeps it safe on worker threads
+//Like du, the CNet ends at the first '!', so a lookup matches the rows du would print
+int parse_data_line(char * line, char ** CNet, char ** file) {
+    int sum = 0;
+    int token_no = 0;
+    char * save;
+    *CNet = NULL;
+    *file = NULL;
+    for (char * token = strtok_r(line, " ", &save); token != NULL; token = strtok_r(NULL, " ", &save)) {
+        token[strcspn(token, "\n")] = 0;
+        if (token_no == 0) {
+            token[strcspn(token, "!")] = 0;
+            *CNet = token;
+        }
+        else if (token_no == 1) {
+            *file = token;
+        }
+        else {
+            sum += size_of_var(token);
+        }
+        token_no++;
+    }
+    return sum;
+}
+
+//Function to parse the data file once into the index, skipping its "users lines" header
+void index_build(user_index * index, const char * filename) {
+    FILE * fin = fopen(filename, "r");
+    if (fin == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    char * line = NULL;
+    size_t len = 0;
+    int line_no = 0;
+    while (getline(&line, &len, fin) != -1) {
+        if (line_no++ == 0) {
+            continue;
+        }
+        char * CNet;
+        char * file;
+        int sum = parse_data_line(line, &CNet, &file);
+        if (CNet != NULL && file != NULL) {
+            index_add(index, CNet, file, sum);
+        }
+    }
+    free(line);
+    fclose(fin);
+}
+
+//Function to move every line of src to the end of dst, appending each src chain to its user's chain in dst
+//The file names change hands, src is freed
+void index_merge(user_index * dst, user_index * src) {
+    int offset = dst->nlines;
+    if (dst->nlines + src->nlines > dst->lines_size) {
+        while (dst->nlines + src->nlines > dst->lines_size) {
+            dst->lines_size *= 2;
+        }
+        dst->lines = realloc(dst->lines, dst->lines_size * sizeof(data_line));
+        if (dst->lines == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < src->nlines; i++) {
+        dst->lines[offset + i] = src->lines[i];
+        if (src->lines[i].next >= 0) {
+            dst->lines[offset + i].next += offset;
+        }
+    }
+    dst->nlines += src->nlines;
+    for (int u = 0; u < src->nusers; u++) {
+        int g = index_user(dst, src->users[u].CNet);
+        if (dst->users[g].last >= 0) {
+            dst->lines[dst->users[g].last].next = src->users[u].first + offset;
+        }
+        else {
+            dst->users[g].first = src->users[u].first + offset;
+        }
+        dst->users[g].last = src->users[u].last + offset;
+        free(src->users[u].CNet);
+    }
+    free(src->lines);
+    free(src->users);
+    free(src->slots);
+}
+
+//Structure for one worker of the threaded backend: its line-aligned slice of the mapped data file
+//and the index of just that slice
+typedef struct index_job {
+  const char * start;
+  const char * end;
+  user_index index;
+} index_job;
+
+//Function run by each worker thread: tokenize the lines of its slice into its own index
+void * index_worker(void * arg) {
+    index_job * job = arg;
+    index_init(&job->index);
+    size_t size = 256;
+    char * line = malloc(size);
+    if (line == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (const char * pos = job->start; pos < job->end;) {
+        const char * eol = memchr(pos, '\n', job->end - pos);
+        size_t len = (eol != NULL ? eol : job->end) - pos;
+        //The mapping is read only, so each line is tokenized in a private copy
+        if (len + 1 > size) {
+            size = len + 1;
+            line = realloc(line, size);
+            if (line == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(line, pos, len);
+        line[len] = 0;
+        char * CNet;
+        char * file;
+        int sum = parse_data_line(line, &CNet, &file);
+        if (CNet != NULL && file != NULL) {
+            index_add(&job->index, CNet, file, sum);
+        }
+        pos += len + 1;
+    }
+    free(line);
+    return NULL;
+}
+
+//Function to build the index with nthreads threads over one shared mapping of the data file
+//The lines after the "users lines" header are split into line-aligned slices of about equal size, each
+//tokenized into a thread-local index; the slices are merged in file order, so chains match index_build
+void index_build_threaded(user_index * index, const char * filename, int nthreads) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    const char * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    const char * end = data + st.st_size;
+    const char * header = memchr(data, '\n', st.st_size);
+    const char * body = header != NULL ? header + 1 : end;
+    index_job * jobs = calloc(nthreads, sizeof(index_job));
+    pthread_t * threads = malloc(nthreads * sizeof(pthread_t));
+    if (jobs == NULL || threads == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    //Each slice ends just past the first line break at or after its even share of the bytes
+    const char * pos = body;
+    for (int t = 0; t < nthreads; t++) {
+        const char * cut = t == nthreads - 1 ? end : body + (end - body) * (t + 1) / nthreads;
+        if (cut < pos) {
+            cut = pos;
+        }
+        if (cut < end && cut > body && cut[-1] != '\n') {
+            const char * eol = memchr(cut, '\n', end - cut);
+            cut = eol != NULL ? eol + 1 : end;
+        }
+        jobs[t].start = pos;
+        jobs[t].end = cut;
+        pos = cut;
+        if (pthread_create(&threads[t], NULL, index_worker, &jobs[t]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+        index_merge(index, &jobs[t].index);
+    }
+    munmap((void *)data, st.st_size);
+    free(jobs);
+    free(threads);
+}
+
+//Function to answer each CNet line of in from the index, in input order, with the rows du prints for it
+void index_answer(const user_index * index, FILE * in) {
+    char * line = NULL;
+    size_t len = 0;
+    while (getline(&line, &len, in) != -1) {
+        line[strcspn(line, "\n")] = 0;
+        int u = index_find(index, line);
+        if (u < 0) {
+            printf("User not found\n");
+            continue;
+        }
+        for (int i = index->users[u].first; i >= 0; i = index->lines[i].next) {
+            printf("%s\t %s\t %d\n", line, index->lines[i].file, index->lines[i].bytecount);
+        }
+    }
+    free(line);
 }
 
 //TO check if file argument is provided, and to check if the provided argument is valid
@@ -64,30 +498,91 @@ void file_check(char * filename){
     }
 }
 
+//Function to print usage
+void usage(const char * prog) {
+    fprintf(stderr, "usage: %s [-i | -t threads | -j children] datafile < cnets\n", prog);
+    fprintf(stderr, "  without -i or -t, one " DU_PATH " child per CNet line re-reads datafile for its user\n");
+    fprintf(stderr, "  -j  children run at once (default: online CPUs)\n");
+    fprintf(stderr, "  -i  parse datafile once into a per-user index and answer every CNet from it, in input order\n");
+    fprintf(stderr, "  -t  like -i, but map datafile once and parse it on threads threads (0: online CPUs)\n");
+}
+
+//Function to read a whole decimal option value of at least min, returns -1 for anything else
+int parse_count(const char * arg, long min, long * value) {
+    char * end;
+    errno = 0;
+    *value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || *value < min) {
+        return -1;
+    }
+    return 0;
+}
+
 //Main func
-int main(char argc, char *argv[])
+int main(int argc, char *argv[])
 {
-    file_check(argv[1]);
-    pid_t wpid, pid;
-    char *line = NULL;
-    int i, child_status;
-    long int len = 0;
-    int line_no = 0;
-    long nRead = getline(&line, &len, stdin);
-    //Reading lines one by one until empty line is encountered
-    while ( nRead != -1) 
-    {
-        line_no++;
-        line[strcspn(line, "\n")] = 0;
-        forkfunc(line,argv[1],pid);
-        free(line);
-        line = NULL;
-        nRead = getline(&line, &len, stdin);
+    int single_parse = 0;
+    long nthreads = 0;
+    long nchildren = sysconf(_SC_NPROCESSORS_ONLN);
+    int children_set = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "it:j:")) != -1) {
+        if (opt == 'i') {
+            single_parse = 1;
+        }
+        else if (opt == 't') {
+            single_parse = 1;
+            if (parse_count(optarg, 0, &nthreads) != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (nthreads == 0) {
+                nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+            if (nthreads < 1) {
+                nthreads = 1;
+            }
+        }
+        else if (opt == 'j') {
+            children_set = 1;
+            if (parse_count(optarg, 1, &nchildren) != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
     }
-    //If all child processes have exited successfully, print "Done." 
-    if (check_child_exit(child_status, wpid, line_no) == 0){
+    //-j sizes the child pool, which the single-parse modes never start
+    if (single_parse && children_set) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    file_check(argv[optind]);
+    //Single-parse mode: one pass over the data file (threaded with -t), then one lookup per CNet
+    if (single_parse) {
+        user_index index;
+        index_init(&index);
+        if (nthreads > 0) {
+            index_build_threaded(&index, argv[optind], nthreads);
+        }
+        else {
+            index_build(&index, argv[optind]);
+        }
+        index_answer(&index, stdin);
+        index_free(&index);
         printf("Done.\n");
+        return 0;
     }
-    return 0;
+    //Reading CNet lines one by one until EOF, each one handed to a du child from the pool
+    if (nchildren < 1) {
+        nchildren = 1;
+    }
+    //"Done." is printed once every child has been reaped, failed or not; a failure only shows in the exit status
+    int failures = spawn_pool(stdin, argv[optind], nchildren);
+    printf("Done.\n");
+    return failures == 0 ? 0 : EXIT_FAILURE;
 }
 
@@ -3,14 +3,30 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 //Structure to store the final ouput
 //Modified struct final to allow for dynamic string length for Name
+//Totals are 64 bit, a large manifest overflows an int
+//user is -1 for a per-user total, or the id of the user a per-(user, file) total belongs to
 typedef struct final {
   char * Name;
-  int flie_size;
+  long long file_size;
+  int user;
 } final;
 
+//Open-addressing hash table of totals keyed by (user, Name), linear probing, grown at 3/4 load
+//Per-user totals are keyed by (-1, CNet), per-file totals by (user id, file)
+//Each distinct key is interned once into users[], in order of first appearance;
+//slots hold index + 1 (0 marks an empty slot)
+typedef struct user_table {
+  final * users;
+  int count;
+  int size;
+  int * slots;
+  int capacity;
+} user_table;
+
 //Structure to store data for individual lines
 //Modified struct final to allow for dynamic string lengths for CNet, and file
 typedef struct linebyline {
@@ -55,31 +71,94 @@ int find_user_data(char * line,int *users, int *no_of_lines){
     return 0;      
 }
 
-//Function to remove duplicate entries from ptr1 array and store values in ptr2
-//Uses strcmp() for string comparisons, and strcpy() for string copy
-void save_unique_users(linebyline *ptr1,final *ptr2, int users, int no_of_lines){
-    int index = 0;
-    for (int i=0; i< no_of_lines; i++){
-        if (strcmp((ptr1+ i)->CNet, "NULL") == 0){
-            continue;
+//Function to hash a string (FNV-1a)
+uint64_t hash_string(const char * str){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *str != '\0'; str++){
+        h = (h ^ (unsigned char)*str) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+//Function to allocate an empty user table, capacity must be a power of two
+void user_table_init(user_table *table, int capacity){
+    table->count = 0;
+    table->size = 64;
+    table->capacity = capacity;
+    table->users = malloc(table->size * sizeof(final));
+    table->slots = calloc(capacity, sizeof(int));
+    if (table->users == NULL || table->slots == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void user_table_free(user_table *table){
+    for (int i = 0; i < table->count; i++){
+        free(table->users[i].Name);
+    }
+    free(table->users);
+    free(table->slots);
+}
+
+//Function to find the slot holding (user, name), or the empty slot where it belongs
+int user_probe(user_table *table, int user, const char * name){
+    int mask = table->capacity - 1;
+    int i = (hash_string(name) ^ (uint64_t)(user + 1) * 0x9E3779B97F4A7C15ULL) & mask;
+    while (table->slots[i] != 0 && (table->users[table->slots[i] - 1].user != user
+                                    || strcmp(table->users[table->slots[i] - 1].Name, name) != 0)){
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+//Function to get the id of (user, name), interning it with a zero total the first time it is seen
+int user_intern(user_table *table, int user, const char * name){
+    if ((table->count + 1) * 4 > table->capacity * 3){
+        //Double the slot array and reinsert every user
+        free(table->slots);
+        table->capacity *= 2;
+        table->slots = calloc(table->capacity, sizeof(int));
+        if (table->slots == NULL){
+            perror("malloc");
+            exit(EXIT_FAILURE);
         }
-        else{
-            int storesum = (ptr1+ i)->bytecount;
-            for (int j = i+1; j< no_of_lines; j++){
-                if (strcmp((ptr1+ i)->CNet, (ptr1+ j)->CNet) == 0){
-                    storesum += (ptr1+ j)->bytecount;
-                    strcpy((ptr1 + j)->CNet, "NULL");
-                }
-            }
-            ptr2[index].Name = malloc(sizeof(char)*strlen((ptr1 + i)->CNet));
-            strcpy((ptr2 + index)->Name, (ptr1 + i)->CNet);
-            (ptr2+ index)->flie_size = storesum;
-            index += 1;
-        }      
-    }
-    for (int i = 0; i < users; ++i) {
-    printf("%s\t%d\n", (ptr2 + i)->Name, (ptr2 + i)->flie_size);
-  }
+        for (int u = 0; u < table->count; u++){
+            table->slots[user_probe(table, table->users[u].user, table->users[u].Name)] = u + 1;
+        }
+    }
+    int i = user_probe(table, user, name);
+    if (table->slots[i] != 0){
+        return table->slots[i] - 1;
+    }
+    if (table->count == table->size){
+        table->size *= 2;
+        table->users = realloc(table->users, table->size * sizeof(final));
+        if (table->users == NULL){
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    table->users[table->count].Name = strdup(name);
+    table->users[table->count].file_size = 0;
+    table->users[table->count].user = user;
+    table->slots[i] = ++table->count;
+    return table->count - 1;
+}
+
+//Function to total the bytes of every user in one pass over the lines and print them in order of first appearance
+//The lines are left as they are, the number of users does not need to be known up front
+void save_unique_users(linebyline *ptr1, int no_of_lines){
+    user_table table;
+    user_table_init(&table, 1024);
+    for (int i = 0; i < no_of_lines; i++){
+        int id = user_intern(&table, -1, (ptr1 + i)->CNet);
+        table.users[id].file_size += (ptr1 + i)->bytecount;
+    }
+    for (int i = 0; i < table.count; ++i) {
+        printf("%s\t%lld\n", table.users[i].Name, table.users[i].file_size);
+    }
+    user_table_free(&table);
 }
 
 //Function to match users with the given CNEY ID
@@ -98,22 +177,23 @@ void user_file_check(linebyline *ptr1, int no_of_lines, char * CNet){
         
 }
 
-//Function to tokenize the string in all n-1 lines, and compute the variable sizes using size_of_var function
-void file_size_compute(struct linebyline *ptr1, char * line, int line_no){
+//Function to tokenize one line in place into its CNet and file, returns the variable sizes summed by size_of_var
+//cnetid and filename are left NULL when the line is missing them
+int parse_line(char * line, char ** cnetid, char ** filename){
     int sum_of_line = 0;
     int token_count = 0;
-    char * cnetid; 
-    char * filename;
+    *cnetid = NULL;
+    *filename = NULL;
     char * token = strtok(line, " ");
     while (token != NULL) {
         //strcspn() function used for removing trailing whitespace
         //Citation : https://www.tutorialspoint.com/c_standard_library/c_function_strcspn.htm
         token[strcspn(token, "\n")] = 0;
         if (token_count == 0){
-            cnetid = token;   
+            *cnetid = token;   
         }
         else if (token_count == 1){
-            filename = token;
+            *filename = token;
         }
         else{
             sum_of_line += size_of_var(token);
@@ -121,19 +201,111 @@ void file_size_compute(struct linebyline *ptr1, char * line, int line_no){
         token = strtok(NULL, " ");
         token_count += 1;
     }
-    ptr1[line_no -1].CNet = malloc(sizeof(char)*strlen(cnetid));
-    strcpy((ptr1 + line_no -1)->CNet, cnetid);
-    ptr1[line_no -1].file = malloc(sizeof(char)*strlen(filename));
-    strcpy((ptr1 + line_no -1)->file, filename);
+    return sum_of_line;
+}
+
+//Function to tokenize the string in all n-1 lines, and compute the variable sizes using size_of_var function
+void file_size_compute(struct linebyline *ptr1, char * line, int line_no){
+    char * cnetid; 
+    char * filename;
+    int sum_of_line = parse_line(line, &cnetid, &filename);
+    ptr1[line_no -1].CNet = strdup(cnetid);
+    ptr1[line_no -1].file = strdup(filename);
     (ptr1+ line_no-1)->bytecount = sum_of_line;
 }
 
+//Function to check whether a line is the "users lines" count header
+int is_count_header(const char * line){
+    int users;
+    int no_of_lines;
+    char rest;
+    return sscanf(line, "%d %d %c", &users, &no_of_lines, &rest) == 2;
+}
+
+//Function to aggregate stdin line by line without keeping the lines: per-user and per-(user, file) totals
+//are added up as each line is read, so memory grows with the distinct keys only
+//The count header is optional; each user is printed in order of first appearance, followed by its files
+void stream_users(FILE * in){
+    user_table table;
+    user_table_init(&table, 1024);
+    char *line = NULL;
+    size_t len = 0;
+    int first = 1;
+    while (getline(&line, &len, in) != -1){
+        if (first && is_count_header(line)){
+            first = 0;
+            continue;
+        }
+        first = 0;
+        char * cnetid;
+        char * filename;
+        int sum_of_line = parse_line(line, &cnetid, &filename);
+        if (cnetid == NULL || filename == NULL){
+            continue;
+        }
+        int user = user_intern(&table, -1, cnetid);
+        table.users[user].file_size += sum_of_line;
+        int file = user_intern(&table, user, filename);
+        table.users[file].file_size += sum_of_line;
+    }
+    free(line);
+    //Counting sort of the per-file totals by user, keeping each user's files in order of first appearance
+    int * start = calloc(table.count + 1, sizeof(int));
+    int * order = malloc((table.count + 1) * sizeof(int));
+    if (start == NULL || order == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < table.count; i++){
+        if (table.users[i].user >= 0){
+            start[table.users[i].user + 1]++;
+        }
+    }
+    for (int i = 0; i < table.count; i++){
+        start[i + 1] += start[i];
+    }
+    for (int i = 0; i < table.count; i++){
+        if (table.users[i].user >= 0){
+            order[start[table.users[i].user]++] = i;
+        }
+    }
+    //Placing moved each start to the end of its run, the previous one is where the run begins
+    for (int i = 0; i < table.count; i++){
+        if (table.users[i].user != -1){
+            continue;
+        }
+        printf("%s\t%lld\n", table.users[i].Name, table.users[i].file_size);
+        for (int f = i > 0 ? start[i - 1] : 0; f < start[i]; f++){
+            printf("%s\t %s\t %lld\n", table.users[i].Name, table.users[order[f]].Name, table.users[order[f]].file_size);
+        }
+    }
+    free(start);
+    free(order);
+    user_table_free(&table);
+}
+
+//Function to print how du is run
+void usage(const char * prog){
+    fprintf(stderr, "usage: %s [-s | cnet] < datafile\n", prog);
+    fprintf(stderr, "none  print each user's total, in order of first appearance\n");
+    fprintf(stderr, "cnet  print the files of cnet and their totals\n");
+    fprintf(stderr, "-s    stream the data, the count header is optional: each user's total, then a\n");
+    fprintf(stderr, "      \"user\\t file\\t total\" line for each of the user's files\n");
+}
+
 //Main function
 int main(int argc, char *argv[]) {
+    if (argc > 2){
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    //Streaming mode never holds the input, so it runs on its own
+    if (argc == 2 && strcmp(argv[1], "-s") == 0){
+        stream_users(stdin);
+        return 0;
+    }
     //Instantiated an object of struct linebyline
     struct linebyline *ptr1;
-    //Instantiated an object of struct final
-    struct final *ptr2;
     char *line = NULL;
     long int len = 0;
     long nRead = getline(&line, &len, stdin);
@@ -144,9 +316,8 @@ int main(int argc, char *argv[]) {
     while ( nRead != -1) {
         if (line_no == 0) {
             find_user_data(line, &users, &no_of_lines); 
-            //Allocated memory for the structs
+            //Allocated memory for the lines, the users are counted as they are seen
             ptr1 = (struct linebyline *)malloc(no_of_lines * sizeof(struct linebyline));
-            ptr2 = (struct final *)malloc(users * sizeof(struct final));
         }
         else {
             //Function file_size_compute called 
@@ -162,7 +333,7 @@ int main(int argc, char *argv[]) {
         user_file_check(ptr1, no_of_lines, argv[1]);
     }
     else if(argc == 1){
-        save_unique_users(ptr1,ptr2,users,no_of_lines);
+        save_unique_users(ptr1,no_of_lines);
     }
     
     return 0;